@@ -22,36 +22,386 @@
 #define ORTHTREE_H
 
 #include <string>
+#include <istream>
+#include <ostream>
+#include <sstream>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <array>
+#include <algorithm>
 #include <functional>
+#include <list>
+#include <unordered_map>
+#include <map>
+#include <optional>
+#include <limits>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <variant>
+#include <utility>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
 
-template<size_t dimensions = 2, typename T = float>
+#if defined(__GNUC__) || defined(__clang__)
+#define ORTHTREE_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define ORTHTREE_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#else
+#define ORTHTREE_PREFETCH(address) ((void)(address))
+#endif
+#if defined(_MSC_VER) && defined(_M_X64) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit of a non-zero word, used to walk occupancy bitmasks
+inline size_t OrthtreeLowestBit(uint64_t word) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_ctzll(word));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    size_t index = 0;
+    for (; !(word & 1); word >>= 1)
+        ++index;
+    return index;
+#endif
+}
+
+// Work-stealing thread pool shared by every parallel entry point of Orthtree.
+// A single pool can be injected into any number of trees (of any dimension) so the
+// library stays within the application's thread budget.
+class OrthtreeThreadPool
+{
+public:
+    enum class Priority { High = 0, Normal = 1, Low = 2 };
+
+    // The calling thread always takes part in ParallelFor, so by default one worker
+    // fewer than the hardware concurrency is spawned. 0 workers runs everything inline.
+    explicit OrthtreeThreadPool(size_t numWorkers = DefaultWorkerCount())
+    {
+        for (size_t i = 0; i < numWorkers; ++i)
+            mQueues.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < numWorkers; ++i)
+            mThreads.emplace_back([this, i] { WorkerLoop(i); });
+    }
+
+    ~OrthtreeThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+            mStop = true;
+        }
+        mWake.notify_all();
+        for (auto& thread : mThreads)
+            thread.join();
+    }
+
+    OrthtreeThreadPool(const OrthtreeThreadPool&) = delete;
+    OrthtreeThreadPool& operator=(const OrthtreeThreadPool&) = delete;
+
+    // Process-wide pool, created on first use
+    static OrthtreeThreadPool& Shared()
+    {
+        static OrthtreeThreadPool pool;
+        return pool;
+    }
+
+    static size_t DefaultWorkerCount() noexcept
+    {
+        size_t hardware = std::thread::hardware_concurrency();
+        return hardware > 1 ? hardware - 1 : 0;
+    }
+
+    [[nodiscard]] size_t NumWorkers() const noexcept
+    {
+        return mThreads.size();
+    }
+
+    // Queues a task. Workers push to their own queue, other threads spread tasks round-robin.
+    // An exception thrown by a task on a worker is kept for TakeException rather than ending
+    // the process. Without workers the task runs inline and throws to the caller.
+    void Submit(std::function<void()> task, Priority priority = Priority::Normal)
+    {
+        if (mQueues.empty())
+        {
+            task();
+            return;
+        }
+        size_t queue = tWorkerIndex < mQueues.size() && tOwner == this
+                       ? tWorkerIndex
+                       : mNextQueue.fetch_add(1, std::memory_order_relaxed) % mQueues.size();
+        {
+            std::lock_guard<std::mutex> lock(mQueues[queue]->mutex);
+            mQueues[queue]->tasks[static_cast<size_t>(priority)].push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+            ++mPending;
+        }
+        mWake.notify_one();
+    }
+
+    // Runs body(chunkBegin, chunkEnd) over [begin, end) split into chunks of at most grainSize
+    // items (0 picks one automatically). The caller only ever executes chunks of this loop, so
+    // once the range is exhausted it waits for at most one chunk per worker.
+    // The first exception thrown by body is rethrown on the calling thread.
+    void ParallelFor(size_t begin, size_t end, size_t grainSize,
+                     const std::function<void(size_t, size_t)>& body,
+                     Priority priority = Priority::High)
+    {
+        if (begin >= end)
+            return;
+        const size_t count = end - begin;
+        if (grainSize == 0)
+            grainSize = std::max<size_t>(1, count / (8 * (NumWorkers() + 1)));
+        const size_t numChunks = (count + grainSize - 1) / grainSize;
+        if (numChunks == 1 || mQueues.empty())
+        {
+            body(begin, end);
+            return;
+        }
+
+        struct Loop
+        {
+            std::atomic<size_t> next{0}, done{0};
+            std::exception_ptr error;
+            std::mutex errorMutex;
+        };
+        auto loop = std::make_shared<Loop>();
+        // The body reference stays valid: helpers only touch it while a chunk is outstanding,
+        // and the caller does not return before every chunk is done.
+        auto run = [loop, &body, begin, end, grainSize, numChunks] {
+            for (size_t chunk; (chunk = loop->next.fetch_add(1)) < numChunks; loop->done.fetch_add(1))
+            {
+                try
+                {
+                    size_t chunkBegin = begin + chunk * grainSize;
+                    body(chunkBegin, std::min(end, chunkBegin + grainSize));
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(loop->errorMutex);
+                    if (!loop->error)
+                        loop->error = std::current_exception();
+                }
+            }
+        };
+        const size_t numHelpers = std::min(numChunks - 1, NumWorkers());
+        for (size_t i = 0; i < numHelpers; ++i)
+            Submit(run, priority);
+        run();
+        while (loop->done.load() < numChunks)
+            std::this_thread::yield();
+        if (loop->error)
+            std::rethrow_exception(loop->error);
+    }
+
+    // Gets the first exception thrown by a submitted task since the last call, or null
+    std::exception_ptr TakeException()
+    {
+        std::lock_guard<std::mutex> lock(mErrorMutex);
+        return std::exchange(mError, nullptr);
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::array<std::deque<std::function<void()>>, 3> tasks;
+    };
+
+    // Pops the highest priority task available: own queue first (newest), then steals (oldest).
+    bool TryRunOne(size_t self)
+    {
+        std::function<void()> task;
+        for (size_t priority = 0; priority < 3 && !task; ++priority)
+        {
+            for (size_t offset = 0; offset < mQueues.size() && !task; ++offset)
+            {
+                auto& queue = *mQueues[(self + offset) % mQueues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                auto& tasks = queue.tasks[priority];
+                if (tasks.empty())
+                    continue;
+                if (offset == 0)
+                {
+                    task = std::move(tasks.back());
+                    tasks.pop_back();
+                }
+                else
+                {
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+            }
+        }
+        if (!task)
+            return false;
+        --mPending;
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mErrorMutex);
+            if (!mError)
+                mError = std::current_exception();
+        }
+        return true;
+    }
+
+    void WorkerLoop(size_t index)
+    {
+        tWorkerIndex = index;
+        tOwner = this;
+        while (true)
+        {
+            if (TryRunOne(index))
+                continue;
+            std::unique_lock<std::mutex> lock(mSleepMutex);
+            mWake.wait(lock, [this] { return mStop || mPending > 0; });
+            if (mStop)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<std::thread> mThreads;
+    std::mutex mSleepMutex;
+    std::condition_variable mWake;
+    std::atomic<size_t> mPending{0}, mNextQueue{0};
+    bool mStop = false;
+    std::mutex mErrorMutex;
+    std::exception_ptr mError;
+
+    static inline thread_local size_t tWorkerIndex = ~size_t(0);
+    static inline thread_local const OrthtreeThreadPool* tOwner = nullptr;
+};
+
+// Hierarchical Z-buffer for CPU occlusion culling. Level 0 is a copy of a depth buffer holding
+// window depths in [0, 1] (larger is farther, rows from the bottom up as in OpenGL), and every
+// further level stores the farthest depth of each 2x2 block of the level below.
+class OrthtreeDepthPyramid
+{
+public:
+    OrthtreeDepthPyramid(const float* depth, size_t width, size_t height)
+    {
+        if (!width || !height)
+            throw std::invalid_argument("Orthtree error: depth pyramid needs a non-empty depth buffer.");
+        mLevels.push_back({ width, height, std::vector<float>(depth, depth + width * height) });
+        while (width > 1 || height > 1)
+        {
+            const Level& below = mLevels.back();
+            width  = (width + 1) / 2;
+            height = (height + 1) / 2;
+            Level level{ width, height, std::vector<float>(width * height) };
+            for (size_t y = 0; y < height; ++y)
+                for (size_t x = 0; x < width; ++x)
+                {
+                    size_t x0 = 2 * x, y0 = 2 * y;
+                    size_t x1 = std::min(x0 + 1, below.width - 1), y1 = std::min(y0 + 1, below.height - 1);
+                    level.depth[y * width + x] = std::max({ below.At(x0, y0), below.At(x1, y0),
+                                                            below.At(x0, y1), below.At(x1, y1) });
+                }
+            mLevels.push_back(std::move(level));
+        }
+    }
+
+    [[nodiscard]] size_t Width() const noexcept { return mLevels[0].width; }
+    [[nodiscard]] size_t Height() const noexcept { return mLevels[0].height; }
+
+    // Checks whether everything inside the pixel rectangle [minX, maxX] x [minY, maxY] which
+    // is no closer than minDepth lies behind the occluders. Reads at most 3x3 texels of the
+    // level at which the rectangle spans about two of them.
+    [[nodiscard]] bool IsOccluded(float minX, float minY, float maxX, float maxY, float minDepth) const
+    {
+        minX = std::max(minX, 0.0f);
+        minY = std::max(minY, 0.0f);
+        maxX = std::min(maxX, static_cast<float>(Width()) - 1.0f);
+        maxY = std::min(maxY, static_cast<float>(Height()) - 1.0f);
+        if (minX > maxX || minY > maxY)
+            return true;
+        float extent = std::max(maxX - minX, maxY - minY);
+        size_t index = extent > 1.0f ? static_cast<size_t>(std::ceil(std::log2(extent))) : 0;
+        const Level& level = mLevels[std::min(index, mLevels.size() - 1)];
+        const float scale = 1.0f / static_cast<float>(size_t(1) << std::min(index, mLevels.size() - 1));
+        size_t x0 = static_cast<size_t>(minX * scale), x1 = std::min(level.width - 1, static_cast<size_t>(maxX * scale));
+        size_t y0 = static_cast<size_t>(minY * scale), y1 = std::min(level.height - 1, static_cast<size_t>(maxY * scale));
+        for (size_t y = y0; y <= y1; ++y)
+            for (size_t x = x0; x <= x1; ++x)
+                if (minDepth <= level.At(x, y))
+                    return false;
+        return true;
+    }
+
+private:
+    struct Level
+    {
+        size_t width, height;
+        std::vector<float> depth;
+        float At(size_t x, size_t y) const { return depth[y * width + x]; }
+    };
+    std::vector<Level> mLevels;
+};
+
+// T is the coordinate type of the nodes. Points of a point-region tree are stored as PointT,
+// relative to the origin of their leaf when it differs from T, e.g. float points under double
+// precision bounds.
+template<size_t dimensions = 2, typename T = float, typename PointT = T>
 class Orthtree
 {
 public:
+    static constexpr size_t numChildren = size_t(1) << dimensions;
+    // Returned by queries when no node matches
+    static constexpr size_t npos = ~size_t(0);
+    // Number of point locations kept in flight by LocateBatch
+    static constexpr size_t locateGroupSize = 16;
+
+    // Order of the sibling blocks in the node array
+    enum class NodeLayout : uint8_t
+    {
+        BreadthFirst,   // as built by Generate
+        VanEmdeBoas,    // after ReorderVanEmdeBoas
+        Mixed           // blocks appended by Insert since either
+    };
+
     struct VecN
     {
         VecN() = default;
         VecN(std::array<T, dimensions> data) : mData(data) {}
         T& operator[](size_t index) { return mData.at(index); }
+        const T& operator[](size_t index) const { return mData.at(index); }
         VecN& operator=(std::array<T, dimensions> data) { mData = data; return *this; }
-        VecN operator+(T b)  { for (auto& d : mData) d += b; return *this; }
-        VecN operator-(T b)  { for (auto& d : mData) d -= b; return *this; }
-        VecN operator*(T b)  { for (auto& d : mData) d *= b; return *this; }
-        VecN operator/(T b)  { for (auto& d : mData) d /= b; return *this; }
-        VecN operator+=(T b) { for (auto& d : mData) d += b; return *this; }
-        VecN operator-=(T b) { for (auto& d : mData) d -= b; return *this; }
-        VecN operator*=(T b) { for (auto& d : mData) d *= b; return *this; }
-        VecN operator/=(T b) { for (auto& d : mData) d /= b; return *this; }
+        VecN operator+(T b) const { VecN r = *this; return r += b; }
+        VecN operator-(T b) const { VecN r = *this; return r -= b; }
+        VecN operator*(T b) const { VecN r = *this; return r *= b; }
+        VecN operator/(T b) const { VecN r = *this; return r /= b; }
+        VecN& operator+=(T b) { for (auto& d : mData) d += b; return *this; }
+        VecN& operator-=(T b) { for (auto& d : mData) d -= b; return *this; }
+        VecN& operator*=(T b) { for (auto& d : mData) d *= b; return *this; }
+        VecN& operator/=(T b) { for (auto& d : mData) d /= b; return *this; }
         
-        T Distance(VecN& point) const noexcept
+        T Distance(const VecN& point) const noexcept
         {
             T dSqr = static_cast<T>(0);
             for (size_t i = 0; i < dimensions; ++i)
             {
-                T diff = mData[i] - point[i];
+                T diff = mData[i] - point.mData[i];
                 dSqr += diff * diff;
             }
             return std::sqrt(dSqr);
@@ -64,15 +414,19 @@ public:
     {
         VecN pos, size, centre;
         size_t level = 0;
-        std::vector<Node*> children;
+        // Index of the first of numChildren contiguous children in the tree (valid if !isLeaf).
+        // Child i lies in the upper half of axis d when bit d of i is set.
+        size_t firstChild = 0;
         bool isLeaf = true;
+        // Indices of the stored points inside a leaf (point-region trees only)
+        std::vector<size_t> items;
 
         Node() = default;
         Node(const VecN& pos, const VecN& size) : pos(pos), size(size) {};
         Node(const VecN& pos, const VecN& size, const VecN& centre, uint32_t level) :
                 pos(pos), size(size), centre(centre), level(level) {};
 
-        [[nodiscard]] bool ContainsPoint(VecN& point) noexcept
+        [[nodiscard]] bool ContainsPoint(const VecN& point) const noexcept
         {
             for (size_t d = 0; d < dimensions; ++d)
                 if (point[d] < pos[d] || point[d] >= pos[d] + size[d])
@@ -80,100 +434,5167 @@ public:
             return true;
         }
     };
+
+    // Points held by the caller, read in place: coordinate d of point i is axes[d][i * stride].
+    // This covers one array per axis (stride 1) as well as arrays of points (each axis pointing
+    // at the first point's coordinate, stride the number of values per point).
+    struct PointView
+    {
+        std::array<const T*, dimensions> axes{};
+        size_t stride = 1;
+        size_t count = 0;
+
+        [[nodiscard]] VecN operator[](size_t i) const
+        {
+            VecN point;
+            for (size_t d = 0; d < dimensions; ++d)
+                point[d] = axes[d][i * stride];
+            return point;
+        }
+
+        // One array of count values per axis
+        [[nodiscard]] static PointView SoA(const std::array<const T*, dimensions>& axes, size_t count)
+        {
+            return { axes, 1, count };
+        }
+
+        // count points of stride values each, the first dimensions of which are the coordinates
+        [[nodiscard]] static PointView AoS(const T* data, size_t count, size_t stride = dimensions)
+        {
+            PointView view;
+            for (size_t d = 0; d < dimensions; ++d)
+                view.axes[d] = data + d;
+            view.stride = stride;
+            view.count = count;
+            return view;
+        }
+
+#if __cplusplus >= 202002L
+        [[nodiscard]] static PointView SoA(const std::array<std::span<const T>, dimensions>& axes)
+        {
+            PointView view;
+            view.count = axes[0].size();
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                if (axes[d].size() != view.count)
+                    throw std::invalid_argument("Orthtree error: Axis spans differ in length.");
+                view.axes[d] = axes[d].data();
+            }
+            return view;
+        }
+
+        [[nodiscard]] static PointView AoS(std::span<const std::array<T, dimensions>> points)
+        {
+            return AoS(points.empty() ? nullptr : points.front().data(), points.size());
+        }
+
+        // A view of a temporary would dangle once the expression ends
+        static PointView AoS(std::vector<std::array<T, dimensions>>&& points) = delete;
+#endif
+    };
 private:
     std::vector<Node> mNodes;
-    std::queue<Node>  mNodeQueue;
-public:
-    Orthtree()
+    // Parent of each block of siblings. The root is node 0 and every subdivision appends a
+    // block of numChildren nodes, so node i > 0 belongs to block (i - 1) / numChildren.
+    std::vector<size_t> mBlockParent;
+    NodeLayout mLayout = NodeLayout::BreadthFirst;
+    OrthtreeThreadPool* mPool = nullptr;
+    // Incremented whenever the structure of the tree changes
+    uint64_t mVersion = 0;
+    // Points of a point-region tree, referenced by Node::items. They are either owned in
+    // mPoints or, with mExternal set, read from the caller's buffers through mView.
+    std::vector<VecN> mPoints;
+    PointView mView;
+    bool mExternal = false;
+    // Owned points stored as PointT offsets from the pos of their leaf, or from mOrigin for
+    // points outside the tree, used when PointT differs from T. Such trees are still built
+    // from full precision points in mPoints, which are encoded once they reach their leaves.
+    static constexpr bool compactPoints = !std::is_same_v<T, PointT>;
+    std::vector<std::array<PointT, dimensions>> mPayload;
+    VecN mOrigin;
+    size_t mBucketCapacity = 0, mMaxDepth = 0;
+    // Leaf holding each point, or npos for points outside the tree
+    std::vector<size_t> mLeafOf;
+    // Axes along which the root box wraps around
+    std::array<bool, dimensions> mPeriodic{};
+
+    // LRU cache of leaf lists keyed by query parameters
+    struct QueryCache
     {
-        static_assert(dimensions, "Orthtree error: Cannot have a 0-dimensional tree.");
-        static_assert(std::is_arithmetic_v<T>, "Orthtree error: Type T must be numerical.");
+        enum class Shape : uint8_t { Box, Sphere };
+        struct Key
+        {
+            Shape shape;
+            std::array<T, 2 * dimensions> params;
+            bool operator==(const Key& other) const
+            {
+                return shape == other.shape && params == other.params;
+            }
+        };
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const noexcept
+            {
+                size_t hash = static_cast<size_t>(key.shape);
+                for (const T& param : key.params)
+                    hash = hash * 1099511628211ull ^ std::hash<T>()(param);
+                return hash;
+            }
+        };
+        struct Entry
+        {
+            Key key;
+            std::shared_ptr<const std::vector<size_t>> leaves;
+        };
+
+        size_t maxBytes = 0, usedBytes = 0;
+        uint64_t version = 0, invalidations = 0;
+        std::list<Entry> entries; // most recently used first
+        std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash> lookup;
+        std::mutex mutex;
+
+        QueryCache() = default;
+        // Copies of a tree get an empty cache with the same budget
+        QueryCache(const QueryCache& other) : maxBytes(other.maxBytes) {}
+        QueryCache& operator=(const QueryCache& other)
+        {
+            Clear();
+            maxBytes = other.maxBytes;
+            return *this;
+        }
+
+        static size_t EntryBytes(const Entry& entry) noexcept
+        {
+            return sizeof(Entry) + sizeof(Key) + entry.leaves->size() * sizeof(size_t);
+        }
+
+        void Clear()
+        {
+            entries.clear();
+            lookup.clear();
+            usedBytes = 0;
+        }
+
+        void Erase(typename std::list<Entry>::iterator it)
+        {
+            usedBytes -= EntryBytes(*it);
+            lookup.erase(it->key);
+            entries.erase(it);
+        }
+    };
+    mutable std::optional<QueryCache> mCache;
+
+    // Points quantized relative to their leaf's box, item * dimensions + d. When the tree
+    // owns full precision points the codes are stored instead of them, and only points
+    // outside every leaf keep their coordinates; otherwise the codes sit in front of the
+    // PointT payload or the caller's buffers, which refine what they cannot settle.
+    struct QuantizedPoints
+    {
+        unsigned bits = 0;
+        bool stored = false;
+        std::vector<uint8_t> codes8;
+        std::vector<uint16_t> codes16;
+        std::unordered_map<size_t, VecN> outside;
+
+        [[nodiscard]] size_t Code(size_t at) const noexcept
+        {
+            return bits == 8 ? codes8[at] : codes16[at];
+        }
+    };
+    std::optional<QuantizedPoints> mQuantized;
+    // Arithmetic of the quantized cells: steps within an integer leaf are fractions, which T
+    // would truncate to 0
+    using QuantizedScalar = std::conditional_t<std::is_floating_point_v<T>, T, double>;
+
+    // A progressive load which has not read every level yet. Only the points read so far are
+    // stored, numbered in the order they were read; they take back their serialized indices
+    // once the load completes. Nodes whose children are still unread are leaves holding
+    // sample points, one from the subtree of each of their children.
+    struct ProgressiveLoad
+    {
+        std::streampos base;                // position of the file's start in the stream
+        std::vector<uint64_t> offsets;      // of every level, the points outside the tree and the end
+        size_t numPoints = 0, levelsRead = 0;
+        std::vector<size_t> ids;            // serialized index of each point read
+        std::unordered_map<size_t, size_t> items;               // point read for each serialized index
+        std::vector<std::pair<size_t, size_t>> pending;         // nodes with unread children, and their first child
+    };
+    std::optional<ProgressiveLoad> mProgressive;
+
+    // Bounds the squared distances from point to each point of a leaf from their codes alone,
+    // so that lower[j] <= |point - items[j]|^2 <= upper[j]. Axes are processed in turn over
+    // the whole leaf, which lets the compiler vectorize the dequantization.
+    void QuantizedDistanceBounds(size_t leaf, const VecN& point, std::vector<QuantizedScalar>& lower,
+                                 std::vector<QuantizedScalar>& upper) const
+    {
+        using S = QuantizedScalar;
+        const Node& node = mNodes[leaf];
+        const size_t count = node.items.size();
+        const size_t* items = node.items.data();
+        const S levels = static_cast<S>(size_t(1) << mQuantized->bits);
+        lower.assign(count, static_cast<S>(0));
+        upper.assign(count, static_cast<S>(0));
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            const S pos = static_cast<S>(node.pos[d]), size = static_cast<S>(node.size[d]), at = static_cast<S>(point[d]);
+            const S step = size / levels;
+            // Widened by the rounding error of the arithmetic below
+            const S half = step / static_cast<S>(2) + static_cast<S>(4) * std::numeric_limits<S>::epsilon() *
+                           (std::abs(at) + std::abs(pos) + size);
+            const S base = pos + step / static_cast<S>(2) - at;
+            S* lowerData = lower.data();
+            S* upperData = upper.data();
+            auto accumulate = [&](const auto* codes) {
+                if (mPeriodic[d])
+                {
+                    for (size_t j = 0; j < count; ++j)
+                    {
+                        S diff = MinimumImageIn<S>(d, base + static_cast<S>(codes[items[j] * dimensions]) * step);
+                        S nearDiff = std::max(static_cast<S>(0), diff - half), farDiff = diff + half;
+                        lowerData[j] += nearDiff * nearDiff;
+                        upperData[j] += farDiff * farDiff;
+                    }
+                    return;
+                }
+                for (size_t j = 0; j < count; ++j)
+                {
+                    S diff = std::abs(base + static_cast<S>(codes[items[j] * dimensions]) * step);
+                    S nearDiff = std::max(static_cast<S>(0), diff - half), farDiff = diff + half;
+                    lowerData[j] += nearDiff * nearDiff;
+                    upperData[j] += farDiff * farDiff;
+                }
+            };
+            if (mQuantized->bits == 8)
+                accumulate(mQuantized->codes8.data() + d);
+            else
+                accumulate(mQuantized->codes16.data() + d);
+        }
     }
 
-    [[nodiscard]] size_t Size() const noexcept
+    // Dequantizes a point stored as codes, to the centre of its code's cell. Integer points go
+    // to the smallest integer in the cell instead, which is the original point when cells are
+    // at most one unit wide.
+    [[nodiscard]] VecN QuantizedPoint(size_t item) const
     {
-        return mNodes.size();
+        using S = QuantizedScalar;
+        const size_t leaf = mLeafOf[item];
+        if (leaf == npos)
+            return mQuantized->outside.at(item);
+        const Node& node = mNodes[leaf];
+        const S levels = static_cast<S>(size_t(1) << mQuantized->bits);
+        VecN point;
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            const S code = static_cast<S>(mQuantized->Code(item * dimensions + d));
+            if constexpr (std::is_floating_point_v<T>)
+                point[d] = node.pos[d] + (code + static_cast<T>(0.5)) * node.size[d] / levels;
+            else
+            {
+                const S corner = static_cast<S>(node.pos[d]) + code * static_cast<S>(node.size[d]) / levels;
+                point[d] = std::max(node.pos[d], std::min(static_cast<T>(std::ceil(corner)),
+                                                          static_cast<T>(node.pos[d] + node.size[d] - 1)));
+            }
+        }
+        return point;
     }
 
-    [[nodiscard]] Node& operator[](size_t index)
+    // Drops the codes, first turning codes stored in place of the points back into points
+    void DropQuantized()
     {
-        if (index > mNodes.size() - 1)
-            throw std::out_of_range("Orthree error: index " + std::to_string(index) +
-                                    " is out of range. Tree size is " + std::to_string(mNodes.size()));
-        else
-            return mNodes[index];
+        if (mQuantized && mQuantized->stored)
+        {
+            std::vector<VecN> points(mLeafOf.size());
+            for (size_t item = 0; item < points.size(); ++item)
+                points[item] = QuantizedPoint(item);
+            mPoints = std::move(points);
+        }
+        mQuantized.reset();
     }
 
-    void Generate(VecN lowerBounds,
-                  VecN upperBounds,
-                  size_t maxDepth,
-                  std::function<bool(Node&)> subdivisionCondition)
+    // Absolute difference along axis d, taken between the closest periodic images
+    [[nodiscard]] T MinimumImage(size_t d, T diff) const noexcept
     {
-        mNodes.clear();
-        const size_t numChildren = pow(2, dimensions);
+        return MinimumImageIn<T>(d, diff);
+    }
 
-        // Create root node
-        VecN rootSize, rootCentre;
+    // MinimumImage with the arithmetic done in U
+    template<typename U>
+    [[nodiscard]] U MinimumImageIn(size_t d, U diff) const noexcept
+    {
+        diff = diff < static_cast<U>(0) ? -diff : diff;
+        if (!mPeriodic[d])
+            return diff;
+        const U period = static_cast<U>(mNodes[0].size[d]);
+        if (diff + diff <= period)
+            return diff;
+        if (diff >= period)
+            diff = static_cast<U>(std::fmod(static_cast<double>(diff), static_cast<double>(period)));
+        return std::min(diff, period - diff);
+    }
+
+    // Maps point into the box at lower of the given size along the periodic axes
+    [[nodiscard]] VecN Wrap(const VecN& point, const VecN& lower, const VecN& size) const noexcept
+    {
+        VecN result = point;
         for (size_t d = 0; d < dimensions; ++d)
         {
-            rootSize[d]   = upperBounds[d] - lowerBounds[d];
-            rootCentre[d] = lowerBounds[d] + rootSize[d] / static_cast<T>(2);
+            if (!mPeriodic[d] || (point[d] >= lower[d] && point[d] < lower[d] + size[d]))
+                continue;
+            double offset = std::fmod(static_cast<double>(point[d] - lower[d]), static_cast<double>(size[d]));
+            result[d] = lower[d] + static_cast<T>(offset < 0 ? offset + static_cast<double>(size[d]) : offset);
+            if (!(result[d] >= lower[d] && result[d] < lower[d] + size[d]))
+                result[d] = lower[d];
         }
-        mNodeQueue.push({ lowerBounds, rootSize, rootCentre, 0 });
+        return result;
+    }
 
-        while (!mNodeQueue.empty())
-        {
-            auto currNode = mNodeQueue.front();
-            mNodeQueue.pop();
+    [[nodiscard]] VecN Wrap(const VecN& point) const noexcept
+    {
+        return mNodes.empty() ? point : Wrap(point, mNodes[0].pos, mNodes[0].size);
+    }
+
+    // Stored point mapped into the root box, as used to place it in the tree
+    [[nodiscard]] VecN WrappedPoint(size_t item) const
+    {
+        return mExternal ? Wrap(mView[item]) : Point(item);
+    }
 
-            // Subdivide
-            if (currNode.level < maxDepth && subdivisionCondition(currNode))
+    [[nodiscard]] const VecN& Anchor(size_t item) const
+    {
+        return mLeafOf[item] == npos ? mOrigin : mNodes[mLeafOf[item]].pos;
+    }
+
+    // Stores a compact point as its offset from anchor. An offset rounded up to the far side
+    // of the point's leaf is stepped back, so that the point decodes into the leaf holding it.
+    void Encode(size_t item, const VecN& point, const VecN& anchor)
+    {
+        const size_t leaf = mLeafOf[item];
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            T offset = point[d] - anchor[d];
+            PointT value;
+            if constexpr (std::is_integral_v<PointT>)
+                value = static_cast<PointT>(std::llround(static_cast<double>(offset)));
+            else
+                value = static_cast<PointT>(offset);
+            while (leaf != npos && value > static_cast<PointT>(0) &&
+                   !(anchor[d] + static_cast<T>(value) < anchor[d] + mNodes[leaf].size[d]))
             {
-                auto halfSize = currNode.size / 2;
-                currNode.children.resize(numChildren);
-                for (size_t i = 0; i < numChildren; ++i)
-                {
-                    mNodeQueue.push(Node(currNode.pos, halfSize));
-                    auto& currChild = mNodeQueue.back();
-                    currChild.level = currNode.level + 1;
-                    size_t index = i;
-                    for (size_t d = 0; d < dimensions; ++d)
-                    {
-                        currChild.pos[d]   += (index % 2) * currNode.size[d];
-                        currChild.centre[d] = currChild.pos[d] + currChild.size[d] / static_cast<T>(2);
-                        index /= 2;
-                    }
-                    currNode.children[i] = &currChild;
-                }
+                if constexpr (std::is_integral_v<PointT>)
+                    --value;
+                else
+                    value = std::nextafter(value, static_cast<PointT>(0));
             }
-            else
-                currNode.isLeaf = false;
-            mNodes.push_back(std::move(currNode));
+            mPayload[item][d] = value;
         }
     }
 
-    struct Iterator
+    // Writes an owned point, relative to its current anchor for compact points
+    void StorePoint(size_t item, const VecN& point)
     {
-        using iterator_category = std::forward_iterator_tag;
-        using difference_type   = std::ptrdiff_t;
-        using value_type        = Node;
-        using pointer           = Node*;
-        using reference         = Node&;
+        if (IsCompact())
+            Encode(item, point, Anchor(item));
+        else
+            mPoints[item] = point;
+    }
 
-        explicit Iterator(pointer ptr) : mPtr(ptr) {}
+    [[nodiscard]] bool IsCompact() const noexcept
+    {
+        return compactPoints && !mExternal && mPoints.empty();
+    }
 
-        reference operator*() const { return *mPtr; }
-        pointer operator->() { return mPtr; }
-        Iterator& operator++() { mPtr++; return *this; }
-        Iterator operator++(int) { Iterator tmp = *this; ++(*this); return tmp; }
-        friend bool operator== (const Iterator& a, const Iterator& b) { return a.mPtr == b.mPtr; };
-        friend bool operator!= (const Iterator& a, const Iterator& b) { return a.mPtr != b.mPtr; };
-    private:
-        pointer mPtr;
-    };
+    // Links a stored point to another leaf, re-encoding it against the leaf's origin
+    void Relink(size_t item, size_t leaf)
+    {
+        if (IsCompact())
+        {
+            const VecN point = Point(item);
+            mLeafOf[item] = leaf;
+            StorePoint(item, point);
+        }
+        else
+            mLeafOf[item] = leaf;
+    }
 
-    Iterator begin() { return Iterator(mNodes.begin().base()); }
-    Iterator end()   { return Iterator(mNodes.end().base()); }
+    void RequireLoaded() const
+    {
+        if (mProgressive)
+            throw std::logic_error("Orthtree error: A partly loaded progressive tree cannot be changed.");
+    }
+
+    void RequireOwnedPoints() const
+    {
+        RequireLoaded();
+        if (mExternal)
+            throw std::logic_error("Orthtree error: Points viewed from the caller's buffers cannot be changed by the tree.");
+    }
+
+    // Squared distance from point to the closest point of node's box
+    [[nodiscard]] T BoxDistanceSqr(const Node& node, const VecN& point) const noexcept
+    {
+        T dSqr = static_cast<T>(0);
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            T diff = static_cast<T>(0);
+            if (mPeriodic[d])
+                diff = std::max(static_cast<T>(0), MinimumImage(d, point[d] - node.centre[d]) - node.size[d] / static_cast<T>(2));
+            else if (point[d] < node.pos[d])
+                diff = node.pos[d] - point[d];
+            else if (point[d] > node.pos[d] + node.size[d])
+                diff = point[d] - (node.pos[d] + node.size[d]);
+            dSqr += diff * diff;
+        }
+        return dSqr;
+    }
+
+    // Squared distance between the closest points of two nodes' boxes
+    [[nodiscard]] T BoxBoxDistanceSqr(const Node& a, const Node& b) const noexcept
+    {
+        T dSqr = static_cast<T>(0);
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            T diff = mPeriodic[d] ?
+                     std::max(static_cast<T>(0), MinimumImage(d, a.centre[d] - b.centre[d]) - (a.size[d] + b.size[d]) / static_cast<T>(2)) :
+                     std::max({ static_cast<T>(0),
+                                a.pos[d] - (b.pos[d] + b.size[d]),
+                                b.pos[d] - (a.pos[d] + a.size[d]) });
+            dSqr += diff * diff;
+        }
+        return dSqr;
+    }
+
+    // Collects the leaves in depth-first order whose node satisfies overlaps
+    template<typename Overlaps>
+    [[nodiscard]] std::vector<size_t> CollectLeaves(Overlaps&& overlaps) const
+    {
+        std::vector<size_t> result, stack;
+        if (!mNodes.empty())
+            stack.push_back(0);
+        while (!stack.empty())
+        {
+            size_t index = stack.back();
+            stack.pop_back();
+            const Node& node = mNodes[index];
+            if (!overlaps(node))
+                continue;
+            if (node.isLeaf)
+            {
+                result.push_back(index);
+                continue;
+            }
+            for (size_t i = numChildren; i-- > 0;)
+            {
+                stack.push_back(node.firstChild + i);
+                PrefetchNode(node.firstChild + i);
+            }
+        }
+        return result;
+    }
+
+    // Squared distance from point to the farthest corner of node's box
+    [[nodiscard]] T BoxFarDistanceSqr(const Node& node, const VecN& point) const noexcept
+    {
+        T dSqr = static_cast<T>(0);
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            T diff = mPeriodic[d] ?
+                     std::min(MinimumImage(d, point[d] - node.centre[d]) + node.size[d] / static_cast<T>(2),
+                              mNodes[0].size[d] / static_cast<T>(2)) :
+                     std::max(point[d] - node.pos[d], node.pos[d] + node.size[d] - point[d]);
+            dSqr += diff * diff;
+        }
+        return dSqr;
+    }
+
+    // Calls fn(leaf, whole) for every leaf with points within radius of centre. whole is set
+    // when all of the leaf's points are inside the radius and need no distance test.
+    template<typename F>
+    void ForEachLeafInRadius(const VecN& centre, T radius, F&& fn) const
+    {
+        const T radiusSqr = radius * radius;
+        std::vector<size_t> stack;
+        if (!mNodes.empty())
+            stack.push_back(0);
+        while (!stack.empty())
+        {
+            const Node& node = mNodes[stack.back()];
+            stack.pop_back();
+            if (BoxDistanceSqr(node, centre) > radiusSqr)
+                continue;
+            if (node.isLeaf)
+            {
+                if (!node.items.empty() && !fn(node, BoxFarDistanceSqr(node, centre) <= radiusSqr))
+                    return;
+                continue;
+            }
+            for (size_t i = numChildren; i-- > 0;)
+            {
+                stack.push_back(node.firstChild + i);
+                PrefetchNode(node.firstChild + i);
+            }
+        }
+    }
+
+    // Calls fn(item) for every stored point within radius of centre until fn returns false
+    template<typename F>
+    void ForEachPointInRadius(const VecN& centre, T radius, F&& fn) const
+    {
+        const T radiusSqr = radius * radius;
+        const QuantizedScalar boundSqr = static_cast<QuantizedScalar>(radiusSqr);
+        std::vector<QuantizedScalar> lower, upper;
+        ForEachLeafInRadius(centre, radius, [&](const Node& leaf, bool whole) {
+            if (whole || !mQuantized)
+            {
+                for (size_t item : leaf.items)
+                    if ((whole || PointDistanceSqr(centre, Point(item)) <= radiusSqr) && !fn(item))
+                        return false;
+                return true;
+            }
+            // Codes settle most points, the exact coordinates are only read for the rest
+            QuantizedDistanceBounds(static_cast<size_t>(&leaf - mNodes.data()), centre, lower, upper);
+            for (size_t j = 0; j < leaf.items.size(); ++j)
+            {
+                if (lower[j] > boundSqr)
+                    continue;
+                size_t item = leaf.items[j];
+                if ((upper[j] <= boundSqr || PointDistanceSqr(centre, Point(item)) <= radiusSqr) && !fn(item))
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    // Lock-free union-find used to merge clusters from several threads
+    struct DisjointSets
+    {
+        std::unique_ptr<std::atomic<size_t>[]> parent;
+
+        explicit DisjointSets(size_t size) : parent(new std::atomic<size_t>[size])
+        {
+            for (size_t i = 0; i < size; ++i)
+                parent[i].store(i, std::memory_order_relaxed);
+        }
+
+        size_t Find(size_t i)
+        {
+            while (true)
+            {
+                size_t p = parent[i].load();
+                if (p == i)
+                    return i;
+                size_t grandparent = parent[p].load();
+                parent[i].compare_exchange_weak(p, grandparent);
+                i = grandparent;
+            }
+        }
+
+        // Links the larger root below the smaller one so concurrent unions cannot form cycles
+        void Unite(size_t a, size_t b)
+        {
+            while (true)
+            {
+                a = Find(a);
+                b = Find(b);
+                if (a == b)
+                    return;
+                if (a < b)
+                    std::swap(a, b);
+                size_t expected = a;
+                if (parent[a].compare_exchange_strong(expected, b))
+                    return;
+            }
+        }
+    };
+
+    // Looks key up under the cache's lock, but runs query on a miss without it, so that
+    // concurrent readers only contend for the lookup and the insertion. A result is not
+    // inserted if the tree changed or a region was invalidated while it was computed.
+    template<typename Query>
+    std::shared_ptr<const std::vector<size_t>> CachedQuery(const typename QueryCache::Key& key, Query&& query) const
+    {
+        if (!mCache)
+            return std::make_shared<const std::vector<size_t>>(query());
+        auto& cache = *mCache;
+        uint64_t invalidations;
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            if (cache.version != mVersion)
+            {
+                cache.Clear();
+                cache.version = mVersion;
+            }
+            auto found = cache.lookup.find(key);
+            if (found != cache.lookup.end())
+            {
+                cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+                return found->second->leaves;
+            }
+            invalidations = cache.invalidations;
+        }
+
+        typename QueryCache::Entry entry{ key, std::make_shared<const std::vector<size_t>>(query()) };
+        const size_t bytes = QueryCache::EntryBytes(entry);
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        if (bytes > cache.maxBytes || cache.version != mVersion || cache.invalidations != invalidations)
+            return entry.leaves;
+        // Another reader may have inserted the same query meanwhile
+        auto found = cache.lookup.find(key);
+        if (found != cache.lookup.end())
+        {
+            cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+            return found->second->leaves;
+        }
+        while (cache.usedBytes + bytes > cache.maxBytes)
+            cache.Erase(std::prev(cache.entries.end()));
+        cache.entries.push_front(std::move(entry));
+        cache.lookup.emplace(key, cache.entries.begin());
+        cache.usedBytes += bytes;
+        return cache.entries.front().leaves;
+    }
+
+    // Runs fn(i) for every i in [begin, end), on the injected pool if there is one
+    template<typename F>
+    void ParallelFor(size_t begin, size_t end, F&& fn) const
+    {
+        if (!mPool)
+        {
+            for (size_t i = begin; i < end; ++i)
+                fn(i);
+            return;
+        }
+        mPool->ParallelFor(begin, end, 0, [&](size_t chunkBegin, size_t chunkEnd) {
+            for (size_t i = chunkBegin; i < chunkEnd; ++i)
+                fn(i);
+        });
+    }
+
+    // Index of the child of node containing point (point is assumed to be inside node)
+    [[nodiscard]] size_t ChildContaining(const Node& node, const VecN& point) const noexcept
+    {
+        size_t child = node.firstChild;
+        for (size_t d = 0; d < dimensions; ++d)
+            if (point[d] >= node.centre[d])
+                child += size_t(1) << d;
+        return child;
+    }
+
+    void PrefetchNode(size_t index) const noexcept
+    {
+        const char* address = reinterpret_cast<const char*>(mNodes.data() + index);
+        for (size_t offset = 0; offset < sizeof(Node); offset += 64)
+            ORTHTREE_PREFETCH(address + offset);
+    }
+
+    // Prefetches what visiting node will read next: its children or its items
+    void PrefetchContents(const Node& node) const noexcept
+    {
+        if (node.isLeaf)
+        {
+            if (!node.items.empty())
+                ORTHTREE_PREFETCH(node.items.data());
+            return;
+        }
+        const char* address = reinterpret_cast<const char*>(mNodes.data() + node.firstChild);
+        for (size_t offset = 0; offset < numChildren * sizeof(Node); offset += 64)
+            ORTHTREE_PREFETCH(address + offset);
+    }
+
+    // Locates points[begin, end) while keeping up to locateGroupSize descents in flight:
+    // each step prefetches the next node of one query, then moves on to the next query,
+    // so the memory latency of one descent is hidden behind the others.
+    template<typename PointArray>
+    [[nodiscard]] std::vector<size_t> LocateAll(const PointArray& points, size_t count) const
+    {
+        std::vector<size_t> result(count, npos);
+        if (mNodes.empty())
+            return result;
+        auto locate = [&](const auto& located) {
+            if (!mPool)
+                LocateGroup(located, result.data(), 0, count);
+            else
+                mPool->ParallelFor(0, count, 0, [&](size_t begin, size_t end) {
+                    LocateGroup(located, result.data(), begin, end);
+                });
+        };
+        if (IsPeriodic())
+        {
+            std::vector<VecN> wrapped(count);
+            for (size_t i = 0; i < count; ++i)
+                wrapped[i] = Wrap(points[i]);
+            locate(wrapped.data());
+        }
+        else
+            locate(points);
+        return result;
+    }
+
+    template<typename PointArray>
+    void LocateGroup(const PointArray& points, size_t* result, size_t begin, size_t end) const
+    {
+        struct Query { size_t point, node; };
+        std::array<Query, locateGroupSize> inFlight;
+        size_t numInFlight = 0, next = begin;
+        auto start = [&](Query& query) {
+            while (next < end)
+            {
+                size_t i = next++;
+                if (mNodes[0].ContainsPoint(points[i]))
+                {
+                    query = { i, 0 };
+                    return true;
+                }
+                result[i] = npos;
+            }
+            return false;
+        };
+        while (numInFlight < locateGroupSize && start(inFlight[numInFlight]))
+            ++numInFlight;
+        while (numInFlight)
+        {
+            for (size_t q = 0; q < numInFlight;)
+            {
+                Query& query = inFlight[q];
+                const Node& node = mNodes[query.node];
+                if (node.isLeaf)
+                {
+                    result[query.point] = query.node;
+                    if (!start(query))
+                    {
+                        query = inFlight[--numInFlight];
+                        continue;
+                    }
+                }
+                else
+                    query.node = ChildContaining(node, points[query.point]);
+                PrefetchNode(query.node);
+                ++q;
+            }
+        }
+    }
+
+    [[nodiscard]] static bool SameBox(const Node& a, const Node& b) noexcept
+    {
+        for (size_t d = 0; d < dimensions; ++d)
+            if (a.pos[d] != b.pos[d] || a.size[d] != b.size[d] || a.centre[d] != b.centre[d])
+                return false;
+        return true;
+    }
+
+    // Child i of parent, in the upper half of axis d when bit d of i is set
+    [[nodiscard]] static Node MakeChild(const Node& parent, size_t i)
+    {
+        const VecN halfSize = parent.size / static_cast<T>(2);
+        Node child(parent.pos, halfSize);
+        child.level = parent.level + 1;
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            if (i >> d & 1)
+                child.pos[d] += halfSize[d];
+            child.centre[d] = child.pos[d] + halfSize[d] / static_cast<T>(2);
+        }
+        return child;
+    }
+
+    void Subdivide(size_t index)
+    {
+        mNodes[index].isLeaf = false;
+        mNodes[index].firstChild = mNodes.size();
+        mBlockParent.push_back(index);
+        for (size_t i = 0; i < numChildren; ++i)
+            mNodes.push_back(MakeChild(mNodes[index], i));
+    }
+
+    // Moves the items of a subdivided node down into its children
+    void DistributeItems(size_t index)
+    {
+        Node& node = mNodes[index];
+        for (size_t item : node.items)
+            mNodes[ChildContaining(node, WrappedPoint(item))].items.push_back(item);
+        std::vector<size_t>().swap(node.items);
+    }
+
+    // Splits a leaf holding more than bucketCapacity points, and then any child still too full
+    void SplitOverfull(size_t leaf)
+    {
+        std::vector<size_t> pending{ leaf };
+        while (!pending.empty())
+        {
+            size_t index = pending.back();
+            pending.pop_back();
+            if (mNodes[index].items.size() <= mBucketCapacity || mNodes[index].level >= mMaxDepth)
+                continue;
+            Subdivide(index);
+            DistributeItems(index);
+            ++mVersion;
+            mLayout = NodeLayout::Mixed;
+            for (size_t i = 0; i < numChildren; ++i)
+            {
+                size_t child = mNodes[index].firstChild + i;
+                for (size_t item : mNodes[child].items)
+                    Relink(item, child);
+                pending.push_back(child);
+            }
+        }
+    }
+
+    // Removes a block of leaves, moving the last block into its place so that blocks stay
+    // contiguous, and returns the new index of node, which the move may have changed
+    size_t RemoveBlock(size_t block, size_t node)
+    {
+        const size_t last = mBlockParent.size() - 1;
+        const size_t from = 1 + last * numChildren, to = 1 + block * numChildren;
+        if (block != last)
+        {
+            for (size_t i = 0; i < numChildren; ++i)
+            {
+                Node& moved = mNodes[to + i] = std::move(mNodes[from + i]);
+                if (moved.isLeaf)
+                    for (size_t item : moved.items)
+                        mLeafOf[item] = to + i;
+                else
+                    mBlockParent[(moved.firstChild - 1) / numChildren] = to + i;
+            }
+            mBlockParent[block] = mBlockParent[last];
+            mNodes[mBlockParent[block]].firstChild = to;
+            if (node >= from && node < from + numChildren)
+                node = node - from + to;
+        }
+        mBlockParent.pop_back();
+        mNodes.resize(from);
+        return node;
+    }
+
+    // Merges the leaf's siblings back into their parent while they are all leaves holding at
+    // most bucketCapacity points between them, then the parent's siblings in turn
+    void MergeUnderfull(size_t leaf)
+    {
+        for (size_t index = leaf; index != 0 && index != npos;)
+        {
+            const size_t block = (index - 1) / numChildren, first = 1 + block * numChildren;
+            size_t count = 0;
+            for (size_t i = 0; i < numChildren; ++i)
+            {
+                if (!mNodes[first + i].isLeaf)
+                    return;
+                count += mNodes[first + i].items.size();
+            }
+            if (count > mBucketCapacity)
+                return;
+            const size_t parent = mBlockParent[block];
+            Node& node = mNodes[parent];
+            node.isLeaf = true;
+            node.firstChild = 0;
+            for (size_t i = 0; i < numChildren; ++i)
+                for (size_t item : mNodes[first + i].items)
+                {
+                    node.items.push_back(item);
+                    Relink(item, parent);
+                }
+            index = RemoveBlock(block, parent);
+            ++mVersion;
+            mLayout = NodeLayout::Mixed;
+        }
+    }
+
+    // Doubles the root outward, away from point, until it contains point. The old root
+    // becomes one child of the new root and its subtree is kept as is; every level shifts
+    // down by one, and maxDepth with it.
+    void GrowToContain(const VecN& point)
+    {
+        DropQuantized();
+        for (size_t d = 0; d < dimensions; ++d)
+            if (!std::isfinite(static_cast<double>(point[d])) || !(mNodes[0].size[d] > 0) || mPeriodic[d])
+                throw std::out_of_range("Orthtree error: Cannot grow the tree to contain the point.");
+        while (!mNodes[0].ContainsPoint(point))
+        {
+            const VecN oldPos = mNodes[0].pos, oldSize = mNodes[0].size;
+            size_t slot = 0;
+            VecN newPos = oldPos;
+            for (size_t d = 0; d < dimensions; ++d)
+                if (point[d] < oldPos[d])
+                {
+                    slot |= size_t(1) << d;
+                    newPos[d] -= oldSize[d];
+                }
+            // The split plane is the old root's edge itself, which newPos + oldSize need not
+            // round back to, so that ChildContaining agrees with the old root's box
+            VecN split;
+            for (size_t d = 0; d < dimensions; ++d)
+                split[d] = slot >> d & 1 ? oldPos[d] : oldPos[d] + oldSize[d];
+            Node root(newPos, oldSize * static_cast<T>(2));
+            root.centre = split;
+            root.isLeaf = false;
+            root.firstChild = mNodes.size();
+            Node oldRoot = std::move(mNodes[0]);
+            if (!oldRoot.isLeaf)
+                mBlockParent[(oldRoot.firstChild - 1) / numChildren] = root.firstChild + slot;
+            mBlockParent.push_back(0);
+
+            for (Node& node : mNodes)
+                ++node.level;
+            for (size_t i = 0; i < numChildren; ++i)
+            {
+                if (i == slot)
+                {
+                    ++oldRoot.level;
+                    mNodes.push_back(std::move(oldRoot));
+                    continue;
+                }
+                // New siblings meet the old root at the split plane
+                Node child(newPos, oldSize);
+                child.level = 1;
+                for (size_t d = 0; d < dimensions; ++d)
+                {
+                    if (i >> d & 1)
+                        child.pos[d] = split[d];
+                    else
+                        child.size[d] = split[d] - newPos[d];
+                    child.centre[d] = child.pos[d] + child.size[d] / static_cast<T>(2);
+                }
+                mNodes.push_back(std::move(child));
+            }
+            mNodes[0] = std::move(root);
+            mLayout = NodeLayout::Mixed;
+            ++mMaxDepth;
+            ++mVersion;
+
+            // Only a root which was itself a leaf can have held points directly
+            for (size_t item : mNodes[mNodes[0].firstChild + slot].items)
+                mLeafOf[item] = mNodes[0].firstChild + slot;     // same box, so no re-encoding
+        }
+
+        // Points left out when the tree was generated may now fall inside it
+        for (size_t item = 0; item < mLeafOf.size(); ++item)
+            if (mLeafOf[item] == npos && mNodes[0].ContainsPoint(Point(item)))
+            {
+                size_t leaf = Locate(Point(item));
+                mNodes[leaf].items.push_back(item);
+                Relink(item, leaf);
+                SplitOverfull(leaf);
+            }
+    }
+
+    // Appends the sibling blocks of the subtree under block to order in van Emde Boas order,
+    // down to height levels of blocks: the top half of the levels first, then each subtree
+    // hanging below it, each laid out the same way
+    void VanEmdeBoasOrder(size_t block, size_t height, std::vector<size_t>& order) const
+    {
+        if (height == 1)
+        {
+            order.push_back(block);
+            return;
+        }
+        const size_t topHeight = height / 2;
+        VanEmdeBoasOrder(block, topHeight, order);
+        std::vector<size_t> frontier{ block }, next;
+        for (size_t depth = 0; depth < topHeight; ++depth)
+        {
+            next.clear();
+            for (size_t b : frontier)
+                for (size_t i = 0; i < numChildren; ++i)
+                {
+                    const Node& node = mNodes[1 + b * numChildren + i];
+                    if (!node.isLeaf)
+                        next.push_back((node.firstChild - 1) / numChildren);
+                }
+            frontier.swap(next);
+        }
+        for (size_t b : frontier)
+            VanEmdeBoasOrder(b, height - topHeight, order);
+    }
+
+    // Number of levels of blocks in the subtree under block
+    size_t BlockHeight(size_t block) const
+    {
+        size_t height = 0;
+        for (size_t i = 0; i < numChildren; ++i)
+        {
+            const Node& node = mNodes[1 + block * numChildren + i];
+            if (!node.isLeaf)
+                height = std::max(height, BlockHeight((node.firstChild - 1) / numChildren));
+        }
+        return height + 1;
+    }
+
+    template<typename V>
+    static void WriteValue(std::ostream& out, const V& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(V));
+    }
+
+    template<typename V>
+    static V ReadValue(std::istream& in)
+    {
+        V value;
+        if (!in.read(reinterpret_cast<char*>(&value), sizeof(V)))
+            throw std::runtime_error("Orthtree error: Unexpected end of serialized tree.");
+        return value;
+    }
+
+    // LEB128: seven bits per byte, low bits first, high bit set on all but the last byte
+    static void WriteVarint(std::string& out, uint64_t value)
+    {
+        for (; value >= 0x80; value >>= 7)
+            out.push_back(static_cast<char>(value | 0x80));
+        out.push_back(static_cast<char>(value));
+    }
+
+    static uint64_t ReadVarint(const std::string& in, size_t& cursor)
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (cursor >= in.size())
+                break;
+            const auto byte = static_cast<uint8_t>(in[cursor++]);
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+    }
+
+    // Coordinates are coded as their bits XORed with those of their leaf's origin, with which
+    // they share the sign, exponent and leading mantissa bits that the varint then drops
+    using CoordinateBits = std::conditional_t<sizeof(T) <= 1, uint8_t, std::conditional_t<sizeof(T) <= 2, uint16_t,
+                           std::conditional_t<sizeof(T) <= 4, uint32_t, uint64_t>>>;
+
+    static void WriteCoordinate(std::string& out, T value, T origin)
+    {
+        if constexpr (sizeof(T) == sizeof(CoordinateBits))
+        {
+            CoordinateBits bits, originBits;
+            std::memcpy(&bits, &value, sizeof(T));
+            std::memcpy(&originBits, &origin, sizeof(T));
+            WriteVarint(out, static_cast<CoordinateBits>(bits ^ originBits));
+        }
+        else
+            out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static T ReadCoordinate(const std::string& in, size_t& cursor, T origin)
+    {
+        T value;
+        if constexpr (sizeof(T) == sizeof(CoordinateBits))
+        {
+            const uint64_t coded = ReadVarint(in, cursor);
+            if (coded > std::numeric_limits<CoordinateBits>::max())
+                throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+            CoordinateBits originBits;
+            std::memcpy(&originBits, &origin, sizeof(T));
+            const auto bits = static_cast<CoordinateBits>(coded ^ originBits);
+            std::memcpy(&value, &bits, sizeof(T));
+        }
+        else
+        {
+            if (cursor + sizeof(T) > in.size())
+                throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+            std::memcpy(&value, in.data() + cursor, sizeof(T));
+            cursor += sizeof(T);
+        }
+        return value;
+    }
+
+    // Order-0 rANS coder for the bytes of a compressed block. A coded block holds a 1 byte,
+    // the raw size, a 32 byte map of the symbols present, their frequencies scaled to sum to
+    // 1 << ransProbBits, the final coder state and the renormalization bytes. Blocks which
+    // would not shrink are stored raw behind a 0 byte.
+    static constexpr unsigned ransProbBits = 12;
+    static constexpr uint32_t ransTotal = uint32_t(1) << ransProbBits;
+    static constexpr uint32_t ransLow = uint32_t(1) << 23;
+
+    static std::string EntropyEncode(const std::string& raw)
+    {
+        std::string stored(1, '\0');
+        WriteVarint(stored, raw.size());
+        stored += raw;
+        if (raw.empty())
+            return stored;
+
+        std::array<uint64_t, 256> counts{};
+        for (char c : raw)
+            ++counts[static_cast<uint8_t>(c)];
+        std::array<uint32_t, 256> freq{}, start{};
+        uint32_t total = 0;
+        for (size_t s = 0; s < 256; ++s)
+            if (counts[s])
+                total += freq[s] = static_cast<uint32_t>(std::max<uint64_t>(1, counts[s] * ransTotal / raw.size()));
+        // Rounding leaves the total off by at most one per symbol, settled on the most frequent
+        while (total != ransTotal)
+        {
+            uint32_t& largest = *std::max_element(freq.begin(), freq.end());
+            const bool over = total > ransTotal;
+            largest = over ? largest - 1 : largest + 1;
+            total = over ? total - 1 : total + 1;
+        }
+        for (size_t s = 1; s < 256; ++s)
+            start[s] = start[s - 1] + freq[s - 1];
+
+        // Symbols are coded last to first so that they decode first to last
+        uint32_t x = ransLow;
+        std::string renormalization;
+        for (auto it = raw.rbegin(); it != raw.rend(); ++it)
+        {
+            const auto s = static_cast<uint8_t>(*it);
+            const uint32_t xMax = ((ransLow >> ransProbBits) << 8) * freq[s];
+            for (; x >= xMax; x >>= 8)
+                renormalization.push_back(static_cast<char>(x & 0xff));
+            x = ((x / freq[s]) << ransProbBits) + x % freq[s] + start[s];
+        }
+
+        std::string coded(1, '\1');
+        WriteVarint(coded, raw.size());
+        std::string present(32, '\0');
+        for (size_t s = 0; s < 256; ++s)
+            if (freq[s])
+                present[s / 8] = static_cast<char>(present[s / 8] | 1 << s % 8);
+        coded += present;
+        for (size_t s = 0; s < 256; ++s)
+            if (freq[s])
+                WriteVarint(coded, freq[s]);
+        for (unsigned shift = 0; shift < 32; shift += 8)
+            coded.push_back(static_cast<char>(x >> shift & 0xff));
+        coded.append(renormalization.rbegin(), renormalization.rend());
+        return coded.size() < stored.size() ? coded : stored;
+    }
+
+    static std::string EntropyDecode(const std::string& bytes)
+    {
+        if (bytes.empty())
+            throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+        size_t cursor = 1;
+        const uint64_t size = ReadVarint(bytes, cursor);
+        if (bytes[0] == '\0')
+        {
+            if (bytes.size() - cursor != size)
+                throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+            return bytes.substr(cursor);
+        }
+        // No symbol codes in fewer than 1 / 2^15 bytes
+        if (bytes[0] != '\1' || cursor + 32 + 4 > bytes.size() || size > uint64_t(bytes.size()) << 15)
+            throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+
+        std::array<uint32_t, 256> freq{}, start{};
+        const size_t present = cursor;
+        cursor += 32;
+        uint64_t total = 0;
+        for (size_t s = 0; s < 256; ++s)
+            if (static_cast<uint8_t>(bytes[present + s / 8]) >> s % 8 & 1)
+            {
+                const uint64_t f = ReadVarint(bytes, cursor);
+                if (!f || f > ransTotal)
+                    throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+                freq[s] = static_cast<uint32_t>(f);
+                total += f;
+            }
+        if (total != ransTotal || cursor + 4 > bytes.size())
+            throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+        std::vector<uint8_t> symbolOf(ransTotal);
+        for (size_t s = 0; s < 256; ++s)
+        {
+            if (s)
+                start[s] = start[s - 1] + freq[s - 1];
+            std::fill_n(symbolOf.begin() + start[s], freq[s], static_cast<uint8_t>(s));
+        }
+
+        uint32_t x = 0;
+        for (unsigned shift = 0; shift < 32; shift += 8)
+            x |= uint32_t(static_cast<uint8_t>(bytes[cursor++])) << shift;
+        std::string raw(static_cast<size_t>(size), '\0');
+        for (char& c : raw)
+        {
+            const uint32_t slot = x & (ransTotal - 1);
+            const uint8_t s = symbolOf[slot];
+            c = static_cast<char>(s);
+            x = freq[s] * (x >> ransProbBits) + slot - start[s];
+            while (x < ransLow)
+            {
+                if (cursor >= bytes.size())
+                    throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+                x = x << 8 | static_cast<uint8_t>(bytes[cursor++]);
+            }
+        }
+        if (x != ransLow || cursor != bytes.size())
+            throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+        return raw;
+    }
+
+    // Replaces the nodes and points with ones read from a stream, as owned points, and
+    // rebuilds the leaf links and block parents
+    void AdoptNodes(std::vector<Node> nodes, std::vector<VecN> points)
+    {
+        std::vector<size_t> leafOf(points.size(), npos);
+        for (size_t i = 0; i < nodes.size(); ++i)
+            for (size_t item : nodes[i].items)
+            {
+                if (item >= points.size())
+                    throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+                leafOf[item] = i;
+            }
+        std::vector<size_t> blockParent(nodes.empty() ? 0 : (nodes.size() - 1) / numChildren);
+        for (size_t i = 0; i < nodes.size(); ++i)
+            if (!nodes[i].isLeaf)
+                blockParent[(nodes[i].firstChild - 1) / numChildren] = i;
+
+        mNodes = std::move(nodes);
+        mBlockParent = std::move(blockParent);
+        mView = PointView();
+        mExternal = false;
+        mQuantized.reset();
+        mProgressive.reset();
+        mOrigin = mNodes.empty() ? VecN() : mNodes[0].pos;
+        mLeafOf = std::move(leafOf);
+        mPoints = std::move(points);
+        mPayload.clear();
+        if constexpr (compactPoints)
+        {
+            mPayload.resize(mPoints.size());
+            for (size_t item = 0; item < mPoints.size(); ++item)
+                Encode(item, mPoints[item], Anchor(item));
+            std::vector<VecN>().swap(mPoints);
+        }
+        ++mVersion;
+    }
+
+    // Reads the section of a progressive file between two of its offsets, or returns false
+    // if the stream does not hold all of it yet
+    bool ReadProgressiveSection(std::istream& in, size_t section, std::string& bytes) const
+    {
+        const ProgressiveLoad& load = *mProgressive;
+        if (load.offsets[section + 1] < load.offsets[section])
+            throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+        bytes.resize(static_cast<size_t>(load.offsets[section + 1] - load.offsets[section]));
+        in.clear();
+        in.seekg(load.base + static_cast<std::streamoff>(load.offsets[section]));
+        return static_cast<bool>(in.read(bytes.data(), static_cast<std::streamsize>(bytes.size())));
+    }
+
+    // Adds the next level of a progressive load. The nodes of the previous level which have
+    // children give up their sample points, which reappear in those children.
+    bool ReadProgressiveLevel(std::istream& in)
+    {
+        ProgressiveLoad& load = *mProgressive;
+        std::string bytes;
+        if (!ReadProgressiveSection(in, load.levelsRead, bytes))
+            return false;
+
+        // Parse the whole level before changing the tree
+        std::istringstream level(bytes);
+        if (ReadValue<uint64_t>(level) != mNodes.size())
+            throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+        std::vector<Node> nodes;
+        std::vector<uint64_t> firstChildren;
+        std::vector<VecN> coordinates;
+        while (level.peek() != std::char_traits<char>::eof())
+        {
+            Node& node = nodes.emplace_back();
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                node.pos[d] = ReadValue<T>(level);
+                node.size[d] = ReadValue<T>(level);
+                node.centre[d] = ReadValue<T>(level);
+            }
+            node.level = load.levelsRead;
+            firstChildren.push_back(ReadValue<uint64_t>(level));
+            node.items.resize(static_cast<size_t>(ReadValue<uint64_t>(level)));
+            for (size_t& item : node.items)
+            {
+                item = static_cast<size_t>(ReadValue<uint64_t>(level));
+                VecN& point = coordinates.emplace_back();
+                for (size_t d = 0; d < dimensions; ++d)
+                    point[d] = ReadValue<T>(level);
+                if (item >= load.numPoints)
+                    throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+            }
+        }
+        std::sort(load.pending.begin(), load.pending.end(), [](const auto& a, const auto& b) {
+            return a.second < b.second;
+        });
+        if (nodes.size() != (mNodes.empty() ? 1 : load.pending.size() * numChildren))
+            throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+        for (size_t i = 0; i < load.pending.size(); ++i)
+            if (load.pending[i].second != mNodes.size() + i * numChildren)
+                throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+
+        const size_t firstNew = mNodes.size();
+        std::vector<size_t> samples;
+        for (const auto& [index, firstChild] : load.pending)
+        {
+            Node& parent = mNodes[index];
+            samples.insert(samples.end(), parent.items.begin(), parent.items.end());
+            parent.items.clear();
+            parent.isLeaf = false;
+            parent.firstChild = firstChild;
+            mBlockParent.push_back(index);
+        }
+        load.pending.clear();
+        size_t next = 0;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            const size_t index = mNodes.size();
+            Node& node = mNodes.emplace_back(std::move(nodes[i]));
+            for (size_t& item : node.items)
+            {
+                const auto [it, inserted] = load.items.try_emplace(item, mPoints.size());
+                if (inserted)
+                {
+                    load.ids.push_back(item);
+                    mPoints.push_back(coordinates[next]);
+                    mLeafOf.push_back(index);
+                }
+                else
+                    mLeafOf[it->second] = index;
+                item = it->second;
+                ++next;
+            }
+            if (firstChildren[i] != npos)
+                load.pending.push_back({ index, static_cast<size_t>(firstChildren[i]) });
+        }
+        for (size_t item : samples)
+            if (mLeafOf[item] < firstNew)
+                throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+        if (mNodes.size() == 1)
+            mOrigin = mNodes[0].pos;
+        ++load.levelsRead;
+        ++mVersion;
+        return true;
+    }
+
+    // Completes a progressive load once every level has been read, adding the points outside
+    // the tree and giving every point back its serialized index
+    bool FinishProgressive(std::istream& in)
+    {
+        ProgressiveLoad& load = *mProgressive;
+        std::string bytes;
+        if (!load.pending.empty() || !ReadProgressiveSection(in, load.levelsRead, bytes))
+            return false;
+        std::istringstream outside(bytes);
+        std::vector<VecN> points(load.numPoints);
+        for (size_t item = 0; item < mPoints.size(); ++item)
+            points[load.ids[item]] = mPoints[item];
+        size_t numRead = mPoints.size();
+        for (size_t count = static_cast<size_t>(ReadValue<uint64_t>(outside)); count; --count, ++numRead)
+        {
+            const uint64_t item = ReadValue<uint64_t>(outside);
+            if (item >= points.size() || load.items.count(static_cast<size_t>(item)))
+                throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+            for (size_t d = 0; d < dimensions; ++d)
+                points[item][d] = ReadValue<T>(outside);
+        }
+        if (numRead != points.size())
+            throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+        for (Node& node : mNodes)
+            for (size_t& item : node.items)
+                item = load.ids[item];
+        AdoptNodes(std::move(mNodes), std::move(points));
+        return true;
+    }
+
+    template<typename Condition>
+    void Build(const VecN& lowerBounds, const VecN& upperBounds, size_t maxDepth, Condition&& subdivisionCondition)
+    {
+        mQuantized.reset();
+        mProgressive.reset();
+        mOrigin = lowerBounds;
+        mLeafOf.assign(NumPoints(), npos);
+        mNodes.clear();
+        mBlockParent.clear();
+        mLayout = NodeLayout::BreadthFirst;
+        ++mVersion;
+
+        // Create root node
+        VecN rootSize, rootCentre;
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            rootSize[d]   = upperBounds[d] - lowerBounds[d];
+            rootCentre[d] = lowerBounds[d] + rootSize[d] / static_cast<T>(2);
+        }
+        mNodes.push_back({ lowerBounds, rootSize, rootCentre, 0 });
+        for (size_t i = 0; i < NumPoints(); ++i)
+            if (mNodes[0].ContainsPoint(WrappedPoint(i)))
+                mNodes[0].items.push_back(i);
+
+        std::vector<char> subdivide;
+        std::vector<size_t> subdivided;
+        for (size_t levelBegin = 0, levelEnd = 1; levelBegin < levelEnd; levelBegin = levelEnd, levelEnd = mNodes.size())
+        {
+            subdivide.assign(levelEnd - levelBegin, 0);
+            ParallelFor(levelBegin, levelEnd, [&](size_t i) {
+                subdivide[i - levelBegin] = mNodes[i].level < maxDepth && subdivisionCondition(mNodes[i]);
+            });
+            subdivided.clear();
+            for (size_t i = levelBegin; i < levelEnd; ++i)
+                if (subdivide[i - levelBegin])
+                {
+                    Subdivide(i);
+                    subdivided.push_back(i);
+                }
+            if (NumPoints())
+                ParallelFor(0, subdivided.size(), [&](size_t i) { DistributeItems(subdivided[i]); });
+        }
+
+        for (size_t i = 0; i < mNodes.size(); ++i)
+            for (size_t item : mNodes[i].items)
+                Relink(item, i);
+    }
+
+    [[nodiscard]] T PointDistanceSqr(const VecN& a, const VecN& b) const noexcept
+    {
+        T dSqr = static_cast<T>(0);
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            T diff = mPeriodic[d] ? MinimumImage(d, a[d] - b[d]) : a[d] - b[d];
+            dSqr += diff * diff;
+        }
+        return dSqr;
+    }
+public:
+    Orthtree()
+    {
+        static_assert(dimensions, "Orthtree error: Cannot have a 0-dimensional tree.");
+        static_assert(dimensions < sizeof(size_t) * 8, "Orthtree error: Too many dimensions.");
+        static_assert(std::is_arithmetic_v<T>, "Orthtree error: Type T must be numerical.");
+        static_assert(std::is_arithmetic_v<PointT>, "Orthtree error: Type PointT must be numerical.");
+    }
+
+    // Parallel work (e.g. evaluating subdivision conditions) is scheduled on this pool.
+    // nullptr (the default) runs everything on the calling thread. The pool must outlive the tree.
+    void SetThreadPool(OrthtreeThreadPool* pool) noexcept
+    {
+        mPool = pool;
+    }
+
+    [[nodiscard]] OrthtreeThreadPool* GetThreadPool() const noexcept
+    {
+        return mPool;
+    }
+
+    // Makes the root box wrap around along the flagged axes. Points and query positions are
+    // then mapped into the root box, and point, radius, kNN and pair queries use minimum-image
+    // distances, which hold for radii up to half the box along each periodic axis. Nodes are
+    // tested against the nearest image of the query, so no ghost copies are stored and each
+    // point is found at most once. Stored points outside the tree are wrapped in; moving them
+    // drops quantized codes, so the points are then quantized again at the same bit depth.
+    void SetPeriodic(const std::array<bool, dimensions>& periodic)
+    {
+        mPeriodic = periodic;
+        ++mVersion;
+        if (mExternal)
+            return;
+        const unsigned bits = mQuantized ? mQuantized->bits : 0;
+        bool moved = false;
+        for (size_t item = 0; item < mLeafOf.size(); ++item)
+            if (mLeafOf[item] == npos)
+            {
+                MovePoint(item, Point(item));
+                moved = true;
+            }
+        if (moved && bits)
+            QuantizePoints(bits);
+    }
+
+    [[nodiscard]] const std::array<bool, dimensions>& GetPeriodic() const noexcept
+    {
+        return mPeriodic;
+    }
+
+    [[nodiscard]] bool IsPeriodic() const noexcept
+    {
+        return std::find(mPeriodic.begin(), mPeriodic.end(), true) != mPeriodic.end();
+    }
+
+    // Distance between two points, taking the nearest periodic image along periodic axes
+    [[nodiscard]] T Distance(const VecN& a, const VecN& b) const noexcept
+    {
+        return static_cast<T>(std::sqrt(PointDistanceSqr(a, b)));
+    }
+
+    [[nodiscard]] size_t Size() const noexcept
+    {
+        return mNodes.size();
+    }
+
+    [[nodiscard]] Node& operator[](size_t index)
+    {
+        if (index >= mNodes.size())
+            throw std::out_of_range("Orthree error: index " + std::to_string(index) +
+                                    " is out of range. Tree size is " + std::to_string(mNodes.size()));
+        else
+            return mNodes[index];
+    }
+
+    [[nodiscard]] const Node& operator[](size_t index) const
+    {
+        return const_cast<Orthtree&>(*this)[index];
+    }
+
+    // Gets the i-th child of a subdivided node
+    [[nodiscard]] Node& Child(const Node& node, size_t i)
+    {
+        return (*this)[node.firstChild + i];
+    }
+
+    // Gets the index of a node's parent, or npos for the root
+    [[nodiscard]] size_t Parent(size_t index) const
+    {
+        if (index >= mNodes.size())
+            throw std::out_of_range("Orthtree error: index " + std::to_string(index) +
+                                    " is out of range. Tree size is " + std::to_string(mNodes.size()));
+        return index == 0 ? npos : mBlockParent[(index - 1) / numChildren];
+    }
+
+    // Gets the indices of a node's ancestors, from its parent up to the root
+    [[nodiscard]] std::vector<size_t> Ancestors(size_t index) const
+    {
+        std::vector<size_t> ancestors;
+        for (size_t parent = Parent(index); parent != npos; parent = Parent(parent))
+            ancestors.push_back(parent);
+        return ancestors;
+    }
+
+    // Reorders the nodes into a van Emde Boas layout, for trees which are queried far more
+    // often than they change. Sibling blocks stay contiguous and the root stays at index 0,
+    // but blocks are placed recursively: the top half of the levels first, then every subtree
+    // below them. A root to leaf descent then touches O(log_B n) blocks of any size B, at every
+    // level of the memory hierarchy. Node indices change; point indices do not, and quantized
+    // codes, which are relative to their leaf's box, follow their leaf to its new index.
+    void ReorderVanEmdeBoas()
+    {
+        RequireLoaded();
+        mLayout = NodeLayout::VanEmdeBoas;
+        if (mNodes.empty() || mNodes[0].isLeaf)
+            return;
+        const size_t rootBlock = (mNodes[0].firstChild - 1) / numChildren;
+        std::vector<size_t> order;
+        order.reserve(mBlockParent.size());
+        VanEmdeBoasOrder(rootBlock, BlockHeight(rootBlock), order);
+
+        std::vector<size_t> newBlock(mBlockParent.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            newBlock[order[i]] = i;
+        auto remap = [&](size_t index) {
+            return index == 0 || index == npos ? index :
+                   1 + newBlock[(index - 1) / numChildren] * numChildren + (index - 1) % numChildren;
+        };
+
+        std::vector<Node> nodes(mNodes.size());
+        std::vector<size_t> blockParent(mBlockParent.size());
+        nodes[0] = std::move(mNodes[0]);
+        for (size_t index = 1; index < mNodes.size(); ++index)
+            nodes[remap(index)] = std::move(mNodes[index]);
+        for (Node& node : nodes)
+            if (!node.isLeaf)
+                node.firstChild = remap(node.firstChild);
+        for (size_t block = 0; block < mBlockParent.size(); ++block)
+            blockParent[newBlock[block]] = remap(mBlockParent[block]);
+        for (size_t& leaf : mLeafOf)
+            leaf = remap(leaf);
+        mNodes = std::move(nodes);
+        mBlockParent = std::move(blockParent);
+        ++mVersion;
+    }
+
+    [[nodiscard]] NodeLayout GetLayout() const noexcept
+    {
+        return mLayout;
+    }
+
+    // Writes the tree in a binary format in native byte order: the nodes in their current
+    // layout (recorded in the header, see NodeLayout), the leaves' items and the stored
+    // points, as full T coordinates whichever way they are held.
+    void Serialize(std::ostream& out) const
+    {
+        out.write("ORTH", 4);
+        WriteValue(out, uint32_t(1));
+        WriteValue(out, uint32_t(dimensions));
+        WriteValue(out, uint32_t(sizeof(T)));
+        WriteValue(out, static_cast<uint8_t>(mLayout));
+        WriteValue(out, uint64_t(mMaxDepth));
+        WriteValue(out, uint64_t(mBucketCapacity));
+        uint64_t periodic = 0;
+        for (size_t d = 0; d < dimensions; ++d)
+            periodic |= uint64_t(mPeriodic[d]) << d;
+        WriteValue(out, periodic);
+
+        WriteValue(out, uint64_t(mNodes.size()));
+        for (const Node& node : mNodes)
+        {
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                WriteValue(out, node.pos[d]);
+                WriteValue(out, node.size[d]);
+                WriteValue(out, node.centre[d]);
+            }
+            WriteValue(out, uint64_t(node.level));
+            WriteValue(out, uint64_t(node.isLeaf ? npos : node.firstChild));
+            WriteValue(out, uint64_t(node.items.size()));
+            for (size_t item : node.items)
+                WriteValue(out, uint64_t(item));
+        }
+        WriteValue(out, uint64_t(NumPoints()));
+        for (size_t item = 0; item < NumPoints(); ++item)
+        {
+            const VecN point = Point(item);
+            for (size_t d = 0; d < dimensions; ++d)
+                WriteValue(out, point[d]);
+        }
+        if (!out)
+            throw std::runtime_error("Orthtree error: Failed to write the tree.");
+    }
+
+    // Replaces the tree with one written by Serialize. The points are owned by the tree.
+    void Deserialize(std::istream& in)
+    {
+        char magic[4];
+        if (!in.read(magic, 4) || std::string(magic, 4) != "ORTH" || ReadValue<uint32_t>(in) != 1)
+            throw std::runtime_error("Orthtree error: Not a serialized tree.");
+        if (ReadValue<uint32_t>(in) != dimensions || ReadValue<uint32_t>(in) != sizeof(T))
+            throw std::runtime_error("Orthtree error: Serialized tree has different dimensions or coordinate type.");
+        const auto layout = static_cast<NodeLayout>(ReadValue<uint8_t>(in));
+        const size_t maxDepth = static_cast<size_t>(ReadValue<uint64_t>(in));
+        const size_t bucketCapacity = static_cast<size_t>(ReadValue<uint64_t>(in));
+        const uint64_t periodic = ReadValue<uint64_t>(in);
+
+        std::vector<Node> nodes(static_cast<size_t>(ReadValue<uint64_t>(in)));
+        for (Node& node : nodes)
+        {
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                node.pos[d] = ReadValue<T>(in);
+                node.size[d] = ReadValue<T>(in);
+                node.centre[d] = ReadValue<T>(in);
+            }
+            node.level = static_cast<size_t>(ReadValue<uint64_t>(in));
+            const uint64_t firstChild = ReadValue<uint64_t>(in);
+            node.isLeaf = firstChild == npos;
+            node.firstChild = node.isLeaf ? 0 : static_cast<size_t>(firstChild);
+            if (!node.isLeaf && (node.firstChild == 0 || node.firstChild + numChildren > nodes.size()))
+                throw std::runtime_error("Orthtree error: Serialized tree is corrupt.");
+            node.items.resize(static_cast<size_t>(ReadValue<uint64_t>(in)));
+            for (size_t& item : node.items)
+                item = static_cast<size_t>(ReadValue<uint64_t>(in));
+        }
+        std::vector<VecN> points(static_cast<size_t>(ReadValue<uint64_t>(in)));
+        for (VecN& point : points)
+            for (size_t d = 0; d < dimensions; ++d)
+                point[d] = ReadValue<T>(in);
+
+        AdoptNodes(std::move(nodes), std::move(points));
+        mLayout = layout;
+        mMaxDepth = maxDepth;
+        mBucketCapacity = bucketCapacity;
+        for (size_t d = 0; d < dimensions; ++d)
+            mPeriodic[d] = periodic >> d & 1;
+    }
+
+    // Writes the tree level by level for progressive loading. The header gives the offset of
+    // every level. Each level holds its nodes, with the items and coordinates of its leaves,
+    // and for every other node a sample of one point from the subtree of each child, which
+    // stands in for the subtree while its levels are still unread. Points outside the tree
+    // follow the last level.
+    void SerializeProgressive(std::ostream& out) const
+    {
+        // Stable order by level keeps sibling blocks whole, whatever the current layout
+        std::vector<size_t> order(mNodes.size()), newIndex(mNodes.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return mNodes[a].level < mNodes[b].level;
+        });
+        for (size_t i = 0; i < order.size(); ++i)
+            newIndex[order[i]] = i;
+        const size_t numLevels = mNodes.empty() ? 0 : mNodes[order.back()].level + 1;
+
+        // First point of every subtree, children before parents
+        std::vector<size_t> firstItem(mNodes.size(), npos);
+        for (auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            const Node& node = mNodes[*it];
+            if (node.isLeaf)
+                firstItem[*it] = node.items.empty() ? npos : node.items.front();
+            else
+                for (size_t c = 0; c < numChildren && firstItem[*it] == npos; ++c)
+                    firstItem[*it] = firstItem[node.firstChild + c];
+        }
+
+        std::vector<size_t> samples;
+        auto writeItems = [&](std::ostream& buffer, const std::vector<size_t>& items) {
+            WriteValue(buffer, uint64_t(items.size()));
+            for (size_t item : items)
+            {
+                WriteValue(buffer, uint64_t(item));
+                const VecN point = Point(item);
+                for (size_t d = 0; d < dimensions; ++d)
+                    WriteValue(buffer, point[d]);
+            }
+        };
+        std::vector<std::string> sections(numLevels + 1);
+        for (size_t begin = 0; begin < order.size();)
+        {
+            const size_t level = mNodes[order[begin]].level;
+            std::ostringstream buffer;
+            WriteValue(buffer, uint64_t(begin));
+            for (; begin < order.size() && mNodes[order[begin]].level == level; ++begin)
+            {
+                const Node& node = mNodes[order[begin]];
+                for (size_t d = 0; d < dimensions; ++d)
+                {
+                    WriteValue(buffer, node.pos[d]);
+                    WriteValue(buffer, node.size[d]);
+                    WriteValue(buffer, node.centre[d]);
+                }
+                WriteValue(buffer, uint64_t(node.isLeaf ? npos : newIndex[node.firstChild]));
+                if (node.isLeaf)
+                {
+                    writeItems(buffer, node.items);
+                    continue;
+                }
+                samples.clear();
+                for (size_t c = 0; c < numChildren; ++c)
+                    if (firstItem[node.firstChild + c] != npos)
+                        samples.push_back(firstItem[node.firstChild + c]);
+                writeItems(buffer, samples);
+            }
+            sections[level] = buffer.str();
+        }
+        std::ostringstream outside;
+        samples.clear();
+        for (size_t item = 0; item < mLeafOf.size(); ++item)
+            if (mLeafOf[item] == npos)
+                samples.push_back(item);
+        writeItems(outside, samples);
+        sections[numLevels] = outside.str();
+
+        out.write("ORTL", 4);
+        WriteValue(out, uint32_t(1));
+        WriteValue(out, uint32_t(dimensions));
+        WriteValue(out, uint32_t(sizeof(T)));
+        WriteValue(out, uint64_t(mMaxDepth));
+        WriteValue(out, uint64_t(mBucketCapacity));
+        uint64_t periodic = 0;
+        for (size_t d = 0; d < dimensions; ++d)
+            periodic |= uint64_t(mPeriodic[d]) << d;
+        WriteValue(out, periodic);
+        WriteValue(out, uint64_t(NumPoints()));
+        WriteValue(out, uint64_t(numLevels));
+        uint64_t offset = 4 + 3 * sizeof(uint32_t) + 5 * sizeof(uint64_t) + (sections.size() + 1) * sizeof(uint64_t);
+        for (const std::string& section : sections)
+        {
+            WriteValue(out, offset);
+            offset += section.size();
+        }
+        WriteValue(out, offset);
+        for (const std::string& section : sections)
+            out.write(section.data(), static_cast<std::streamsize>(section.size()));
+        if (!out)
+            throw std::runtime_error("Orthtree error: Failed to write the tree.");
+    }
+
+    // Replaces the tree with levels 0 to maxLevel of a file written by SerializeProgressive,
+    // or with as many whole levels as the stream holds when it ends early, as while the file
+    // is still arriving. The stream must be seekable. Until every level has been read the
+    // tree holds only the points read so far: the nodes of the last level read whose children
+    // were not read are leaves holding their samples, and points are numbered in the order
+    // they were read (see SerializedIndex). Such a tree can be queried and serialized but not
+    // changed. Returns the number of levels read.
+    size_t DeserializeProgressive(std::istream& in, size_t maxLevel = npos)
+    {
+        const std::streampos base = in.tellg();
+        char magic[4];
+        if (!in.read(magic, 4) || std::string(magic, 4) != "ORTL" || ReadValue<uint32_t>(in) != 1)
+            throw std::runtime_error("Orthtree error: Not a progressive serialized tree.");
+        if (ReadValue<uint32_t>(in) != dimensions || ReadValue<uint32_t>(in) != sizeof(T))
+            throw std::runtime_error("Orthtree error: Serialized tree has different dimensions or coordinate type.");
+        const size_t maxDepth = static_cast<size_t>(ReadValue<uint64_t>(in));
+        const size_t bucketCapacity = static_cast<size_t>(ReadValue<uint64_t>(in));
+        const uint64_t periodic = ReadValue<uint64_t>(in);
+        ProgressiveLoad load;
+        load.base = base;
+        load.numPoints = static_cast<size_t>(ReadValue<uint64_t>(in));
+        load.offsets.resize(static_cast<size_t>(ReadValue<uint64_t>(in)) + 2);
+        for (uint64_t& offset : load.offsets)
+            offset = ReadValue<uint64_t>(in);
+
+        mNodes.clear();
+        mBlockParent.clear();
+        mView = PointView();
+        mExternal = false;
+        mQuantized.reset();
+        mPoints.clear();
+        mPayload.clear();
+        mLeafOf.clear();
+        mOrigin = VecN();
+        mLayout = NodeLayout::BreadthFirst;
+        mMaxDepth = maxDepth;
+        mBucketCapacity = bucketCapacity;
+        for (size_t d = 0; d < dimensions; ++d)
+            mPeriodic[d] = periodic >> d & 1;
+        mProgressive = std::move(load);
+        ++mVersion;
+        return RefineProgressive(in, maxLevel);
+    }
+
+    // Continues a progressive load from the level where it stopped, reading levels up to
+    // maxLevel, or as many as the stream holds now. Levels already read are not parsed again.
+    // Returns the number of levels read in all.
+    size_t RefineProgressive(std::istream& in, size_t maxLevel = npos)
+    {
+        if (!mProgressive)
+            throw std::logic_error("Orthtree error: No progressive load is in progress.");
+        const size_t numLevels = mProgressive->offsets.size() - 2;
+        while (mProgressive->levelsRead < numLevels && mProgressive->levelsRead <= maxLevel && ReadProgressiveLevel(in)) {}
+        const size_t levelsRead = mProgressive->levelsRead;
+        if (levelsRead == numLevels)
+            FinishProgressive(in);
+        return levelsRead;
+    }
+
+    // Whether a progressive load has levels or points left to read
+    [[nodiscard]] bool IsPartiallyLoaded() const noexcept
+    {
+        return mProgressive.has_value();
+    }
+
+    // Gets the index a stored point has in the serialized tree, which differs from its index
+    // here only while a progressive load is partial
+    [[nodiscard]] size_t SerializedIndex(size_t item) const
+    {
+        return mProgressive ? mProgressive->ids.at(item) : item;
+    }
+
+    // Writes the tree in a compressed format. Nodes are stored coarse to fine in Morton order,
+    // each as the difference of its Morton key from the previous node's, with two bits of
+    // flags (leaf, first node of a new level) packed four to a byte. Leaves add their items,
+    // delta coded, and the coordinates of their points XORed with the leaf's origin. Every
+    // blockNodes nodes start a block, which is entropy coded on its own, and an index of the
+    // blocks' first keys gives CompressedReader random access. Node boxes are recomputed from
+    // the root's, and only the few which do not follow from their parent's, such as those
+    // above a root grown by Insert, are stored.
+    void SerializeCompressed(std::ostream& out, size_t blockNodes = 4096) const
+    {
+        if (!blockNodes)
+            throw std::invalid_argument("Orthtree error: Blocks must hold at least one node.");
+        // Nodes by level and Morton key, which is the order Build creates them in
+        std::vector<std::pair<size_t, uint64_t>> order;     // index and key
+        std::vector<size_t> boxes;                          // positions in order of stored boxes
+        if (!mNodes.empty())
+            order.push_back({ 0, 0 });
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const Node& node = mNodes[order[i].first];
+            if (node.isLeaf)
+                continue;
+            if ((node.level + 1) * dimensions > 64)
+                throw std::invalid_argument("Orthtree error: Tree is too deep for 64 bit Morton keys.");
+            for (size_t c = 0; c < numChildren; ++c)
+            {
+                if (!SameBox(MakeChild(node, c), mNodes[node.firstChild + c]))
+                    boxes.push_back(order.size());
+                order.push_back({ node.firstChild + c, order[i].second * numChildren + c });
+            }
+        }
+
+        std::vector<std::string> blocks;
+        for (size_t begin = 0; begin < order.size(); begin += blockNodes)
+        {
+            const size_t end = std::min(order.size(), begin + blockNodes);
+            std::string block((2 * (end - begin) + 7) / 8, '\0');
+            size_t level = mNodes[order[begin].first].level, lastItem = 0;
+            uint64_t key = order[begin].second;
+            for (size_t i = begin; i < end; ++i)
+            {
+                const Node& node = mNodes[order[i].first];
+                const bool nextLevel = node.level != level;
+                if (nextLevel)
+                {
+                    level = node.level;
+                    key = 0;
+                }
+                const size_t bit = 2 * (i - begin);
+                block[bit / 8] = static_cast<char>(block[bit / 8] | (node.isLeaf | nextLevel << 1) << bit % 8);
+                WriteVarint(block, order[i].second - key);
+                key = order[i].second;
+                if (!node.isLeaf)
+                    continue;
+                WriteVarint(block, node.items.size());
+                for (size_t item : node.items)
+                {
+                    // Zigzag coded, as items are mostly but not always increasing
+                    const int64_t delta = static_cast<int64_t>(item - lastItem);
+                    WriteVarint(block, static_cast<uint64_t>(delta) << 1 ^ static_cast<uint64_t>(delta >> 63));
+                    lastItem = item;
+                    const VecN point = Point(item);
+                    for (size_t d = 0; d < dimensions; ++d)
+                        WriteCoordinate(block, point[d], node.pos[d]);
+                }
+            }
+            blocks.push_back(EntropyEncode(block));
+        }
+
+        out.write("ORTZ", 4);
+        WriteValue(out, uint32_t(1));
+        WriteValue(out, uint32_t(dimensions));
+        WriteValue(out, uint32_t(sizeof(T)));
+        WriteValue(out, uint64_t(mMaxDepth));
+        WriteValue(out, uint64_t(mBucketCapacity));
+        uint64_t periodic = 0;
+        for (size_t d = 0; d < dimensions; ++d)
+            periodic |= uint64_t(mPeriodic[d]) << d;
+        WriteValue(out, periodic);
+        WriteValue(out, uint64_t(NumPoints()));
+        WriteValue(out, uint64_t(mNodes.size()));
+        for (size_t d = 0; d < dimensions && !mNodes.empty(); ++d)
+        {
+            WriteValue(out, mNodes[0].pos[d]);
+            WriteValue(out, mNodes[0].size[d]);
+            WriteValue(out, mNodes[0].centre[d]);
+        }
+        WriteValue(out, uint64_t(boxes.size()));
+        for (size_t position : boxes)
+        {
+            const Node& node = mNodes[order[position].first];
+            WriteValue(out, uint64_t(node.level));
+            WriteValue(out, order[position].second);
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                WriteValue(out, node.pos[d]);
+                WriteValue(out, node.size[d]);
+                WriteValue(out, node.centre[d]);
+            }
+        }
+        WriteValue(out, uint64_t(blocks.size()));
+        uint64_t offset = 0;
+        for (size_t b = 0; b < blocks.size(); ++b)
+        {
+            const size_t begin = b * blockNodes;
+            WriteValue(out, uint64_t(offset));
+            WriteValue(out, uint64_t(blocks[b].size()));
+            WriteValue(out, uint64_t(begin));
+            WriteValue(out, uint64_t(std::min(order.size() - begin, blockNodes)));
+            WriteValue(out, uint64_t(mNodes[order[begin].first].level));
+            WriteValue(out, order[begin].second);
+            offset += blocks[b].size();
+        }
+        for (const std::string& block : blocks)
+            out.write(block.data(), static_cast<std::streamsize>(block.size()));
+
+        // Points outside every leaf follow the blocks
+        std::vector<size_t> unlinked;
+        for (size_t item = 0; item < mLeafOf.size(); ++item)
+            if (mLeafOf[item] == npos)
+                unlinked.push_back(item);
+        WriteValue(out, uint64_t(unlinked.size()));
+        for (size_t item : unlinked)
+        {
+            WriteValue(out, uint64_t(item));
+            const VecN point = Point(item);
+            for (size_t d = 0; d < dimensions; ++d)
+                WriteValue(out, point[d]);
+        }
+        if (!out)
+            throw std::runtime_error("Orthtree error: Failed to write the tree.");
+    }
+
+    // Reads the compressed header and block index, and decodes blocks on demand. Uses the
+    // stream from its position at construction, so one reader must not be shared by threads.
+    class CompressedReader
+    {
+    public:
+        struct BlockNode
+        {
+            size_t level;
+            uint64_t key;
+            bool isLeaf;
+            std::vector<size_t> items;
+            std::vector<VecN> points;
+        };
+
+        explicit CompressedReader(std::istream& in) : mIn(in)
+        {
+            char magic[4];
+            if (!mIn.read(magic, 4) || std::string(magic, 4) != "ORTZ" || ReadValue<uint32_t>(mIn) != 1)
+                throw std::runtime_error("Orthtree error: Not a compressed tree.");
+            if (ReadValue<uint32_t>(mIn) != dimensions || ReadValue<uint32_t>(mIn) != sizeof(T))
+                throw std::runtime_error("Orthtree error: Serialized tree has different dimensions or coordinate type.");
+            mMaxDepth = static_cast<size_t>(ReadValue<uint64_t>(mIn));
+            mBucketCapacity = static_cast<size_t>(ReadValue<uint64_t>(mIn));
+            mPeriodic = ReadValue<uint64_t>(mIn);
+            mNumPoints = static_cast<size_t>(ReadValue<uint64_t>(mIn));
+            mNumNodes = static_cast<size_t>(ReadValue<uint64_t>(mIn));
+            for (size_t d = 0; d < dimensions && mNumNodes; ++d)
+            {
+                mRoot.pos[d] = ReadValue<T>(mIn);
+                mRoot.size[d] = ReadValue<T>(mIn);
+                mRoot.centre[d] = ReadValue<T>(mIn);
+            }
+            for (uint64_t boxes = ReadValue<uint64_t>(mIn); boxes--;)
+            {
+                const size_t level = static_cast<size_t>(ReadValue<uint64_t>(mIn));
+                Node& node = mBoxes[{ level, ReadValue<uint64_t>(mIn) }];
+                for (size_t d = 0; d < dimensions; ++d)
+                {
+                    node.pos[d] = ReadValue<T>(mIn);
+                    node.size[d] = ReadValue<T>(mIn);
+                    node.centre[d] = ReadValue<T>(mIn);
+                }
+                node.level = level;
+            }
+            mBlocks.resize(static_cast<size_t>(ReadValue<uint64_t>(mIn)));
+            for (BlockInfo& block : mBlocks)
+            {
+                block.offset = ReadValue<uint64_t>(mIn);
+                block.bytes = ReadValue<uint64_t>(mIn);
+                block.firstNode = static_cast<size_t>(ReadValue<uint64_t>(mIn));
+                block.numNodes = static_cast<size_t>(ReadValue<uint64_t>(mIn));
+                block.level = static_cast<size_t>(ReadValue<uint64_t>(mIn));
+                block.key = ReadValue<uint64_t>(mIn);
+            }
+            mBase = mIn.tellg();
+        }
+
+        [[nodiscard]] size_t NumNodes() const noexcept
+        {
+            return mNumNodes;
+        }
+
+        [[nodiscard]] size_t NumPoints() const noexcept
+        {
+            return mNumPoints;
+        }
+
+        [[nodiscard]] size_t NumBlocks() const noexcept
+        {
+            return mBlocks.size();
+        }
+
+        // Decodes the nodes of one block, in order of level and Morton key
+        [[nodiscard]] std::vector<BlockNode> DecodeBlock(size_t index) const
+        {
+            const BlockInfo& info = mBlocks.at(index);
+            std::string coded(static_cast<size_t>(info.bytes), '\0');
+            mIn.clear();
+            mIn.seekg(mBase + static_cast<std::streamoff>(info.offset));
+            if (!mIn.read(coded.data(), static_cast<std::streamsize>(coded.size())))
+                throw std::runtime_error("Orthtree error: Unexpected end of serialized tree.");
+            const std::string bytes = EntropyDecode(coded);
+
+            std::vector<BlockNode> nodes(info.numNodes);
+            size_t cursor = (2 * info.numNodes + 7) / 8, level = info.level, lastItem = 0;
+            uint64_t key = info.key;
+            if (cursor > bytes.size())
+                throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                BlockNode& node = nodes[i];
+                const unsigned flags = static_cast<uint8_t>(bytes[2 * i / 8]) >> (2 * i % 8) & 3;
+                if (flags & 2)
+                {
+                    ++level;
+                    key = 0;
+                }
+                node.level = level;
+                node.key = key += ReadVarint(bytes, cursor);
+                node.isLeaf = flags & 1;
+                if (!node.isLeaf)
+                    continue;
+                node.items.resize(static_cast<size_t>(ReadVarint(bytes, cursor)));
+                if (node.items.size() > bytes.size())
+                    throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+                node.points.resize(node.items.size());
+                const VecN origin = node.items.empty() ? VecN() : BoxOf(node.level, node.key).pos;
+                for (size_t j = 0; j < node.items.size(); ++j)
+                {
+                    const uint64_t zigzag = ReadVarint(bytes, cursor);
+                    lastItem += static_cast<size_t>(zigzag >> 1 ^ (~(zigzag & 1) + 1));
+                    node.items[j] = lastItem;
+                    for (size_t d = 0; d < dimensions; ++d)
+                        node.points[j][d] = ReadCoordinate(bytes, cursor, origin[d]);
+                }
+            }
+            return nodes;
+        }
+
+        // Gets the items and coordinates of the points in the leaf containing point, decoding
+        // one block for each level above the leaf at most
+        [[nodiscard]] std::vector<std::pair<size_t, VecN>> PointsInLeaf(const VecN& point) const
+        {
+            if (!mNumNodes || !mRoot.ContainsPoint(point))
+                return {};
+            Node node = mRoot;
+            for (uint64_t key = 0;; )
+            {
+                // Last block starting at or before (level, key)
+                auto block = std::upper_bound(mBlocks.begin(), mBlocks.end(), std::make_pair(node.level, key),
+                                              [](const auto& wanted, const BlockInfo& info) {
+                                                  return wanted < std::make_pair(info.level, info.key);
+                                              });
+                if (block == mBlocks.begin())
+                    return {};
+                std::vector<BlockNode> nodes = DecodeBlock(static_cast<size_t>(block - mBlocks.begin() - 1));
+                auto found = std::find_if(nodes.begin(), nodes.end(), [&](const BlockNode& candidate) {
+                    return candidate.level == node.level && candidate.key == key;
+                });
+                if (found == nodes.end())
+                    return {};
+                if (found->isLeaf)
+                {
+                    std::vector<std::pair<size_t, VecN>> result;
+                    for (size_t j = 0; j < found->items.size(); ++j)
+                        result.push_back({ found->items[j], found->points[j] });
+                    return result;
+                }
+                size_t child = 0;
+                for (size_t d = 0; d < dimensions; ++d)
+                    if (point[d] >= node.centre[d])
+                        child += size_t(1) << d;
+                key = key * numChildren + child;
+                node = ChildOf(node, key, child);
+            }
+        }
+
+    private:
+        friend class Orthtree;
+
+        // Child c of parent, with key its Morton key, taking the stored box if it has one
+        [[nodiscard]] Node ChildOf(const Node& parent, uint64_t key, size_t c) const
+        {
+            Node child = MakeChild(parent, c);
+            auto found = mBoxes.find({ child.level, key });
+            if (found != mBoxes.end())
+            {
+                child.pos = found->second.pos;
+                child.size = found->second.size;
+                child.centre = found->second.centre;
+            }
+            return child;
+        }
+
+        // Box of the node at level with Morton key, descending from the root
+        [[nodiscard]] Node BoxOf(size_t level, uint64_t key) const
+        {
+            if (level * dimensions > 64)
+                throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+            Node node = mRoot;
+            for (size_t l = 1; l <= level; ++l)
+            {
+                const uint64_t prefix = key >> (level - l) * dimensions;
+                node = ChildOf(node, prefix, static_cast<size_t>(prefix & (numChildren - 1)));
+            }
+            return node;
+        }
+
+        struct BlockInfo
+        {
+            uint64_t offset, bytes;
+            size_t firstNode, numNodes, level;
+            uint64_t key;
+        };
+
+        std::istream& mIn;
+        std::streampos mBase;
+        size_t mMaxDepth = 0, mBucketCapacity = 0, mNumPoints = 0, mNumNodes = 0;
+        uint64_t mPeriodic = 0;
+        Node mRoot;
+        std::map<std::pair<size_t, uint64_t>, Node> mBoxes;     // by level and key
+        std::vector<BlockInfo> mBlocks;
+    };
+
+    // Replaces the tree with one written by SerializeCompressed. The points are owned by the tree.
+    void DeserializeCompressed(std::istream& in)
+    {
+        const CompressedReader reader(in);
+        std::vector<Node> nodes;
+        std::vector<uint64_t> keys;
+        std::vector<VecN> points(reader.mNumPoints);
+        if (reader.mNumNodes)
+        {
+            nodes.push_back(reader.mRoot);
+            keys.push_back(0);
+        }
+        // Children are recreated from their parents as Build would, and must match the file
+        size_t index = 0;
+        for (size_t block = 0; block < reader.NumBlocks(); ++block)
+            for (typename CompressedReader::BlockNode& decoded : reader.DecodeBlock(block))
+            {
+                if (index >= nodes.size() || decoded.level != nodes[index].level || decoded.key != keys[index])
+                    throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+                if (!decoded.isLeaf)
+                {
+                    nodes[index].isLeaf = false;
+                    nodes[index].firstChild = nodes.size();
+                    for (size_t c = 0; c < numChildren; ++c)
+                    {
+                        keys.push_back(decoded.key * numChildren + c);
+                        nodes.push_back(reader.ChildOf(nodes[index], keys.back(), c));
+                    }
+                }
+                for (size_t j = 0; j < decoded.items.size(); ++j)
+                {
+                    if (decoded.items[j] >= points.size())
+                        throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+                    points[decoded.items[j]] = decoded.points[j];
+                }
+                nodes[index++].items = std::move(decoded.items);
+            }
+        if (index != nodes.size() || index != reader.mNumNodes)
+            throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+
+        if (!reader.mBlocks.empty())
+        {
+            in.clear();
+            in.seekg(reader.mBase + static_cast<std::streamoff>(reader.mBlocks.back().offset + reader.mBlocks.back().bytes));
+        }
+        for (uint64_t unlinked = ReadValue<uint64_t>(in); unlinked--;)
+        {
+            const size_t item = static_cast<size_t>(ReadValue<uint64_t>(in));
+            if (item >= points.size())
+                throw std::runtime_error("Orthtree error: Compressed tree is corrupt.");
+            for (size_t d = 0; d < dimensions; ++d)
+                points[item][d] = ReadValue<T>(in);
+        }
+
+        AdoptNodes(std::move(nodes), std::move(points));
+        mLayout = NodeLayout::BreadthFirst;
+        mMaxDepth = reader.mMaxDepth;
+        mBucketCapacity = reader.mBucketCapacity;
+        for (size_t d = 0; d < dimensions; ++d)
+            mPeriodic[d] = reader.mPeriodic >> d & 1;
+    }
+
+    // Writes the tree split into pages for PagedOrthtree. Each page holds a subtree's root
+    // and pageLevels levels below it, with the items and coordinates of its leaves. Nodes
+    // subdivided further are repeated as the root of a new page. Pages are written coarse to
+    // fine, followed by a directory of their offsets and root boxes.
+    void WritePages(std::ostream& out, size_t pageLevels) const
+    {
+        if (!pageLevels)
+            throw std::invalid_argument("Orthtree error: Pages must hold at least one level.");
+        if (IsPeriodic())
+            throw std::logic_error("Orthtree error: Paged trees do not support periodic boundaries.");
+        out.write("ORTP", 4);
+        WriteValue(out, uint32_t(1));
+        WriteValue(out, uint32_t(dimensions));
+        WriteValue(out, uint32_t(sizeof(T)));
+        WriteValue(out, uint64_t(NumPoints()));
+        uint64_t offset = 4 + 3 * sizeof(uint32_t) + sizeof(uint64_t);
+
+        std::vector<size_t> roots, nodes;
+        std::vector<std::array<uint64_t, 3>> directory;     // offset, bytes and nodes of each page
+        if (!mNodes.empty())
+            roots.push_back(0);
+        for (size_t page = 0; page < roots.size(); ++page)
+        {
+            std::ostringstream buffer;
+            nodes.assign(1, roots[page]);
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                const Node& node = mNodes[nodes[i]];
+                uint64_t firstChild = npos, childPage = npos;
+                if (!node.isLeaf && node.level - mNodes[roots[page]].level < pageLevels)
+                {
+                    firstChild = nodes.size();
+                    for (size_t c = 0; c < numChildren; ++c)
+                        nodes.push_back(node.firstChild + c);
+                }
+                else if (!node.isLeaf)
+                {
+                    childPage = roots.size();
+                    roots.push_back(nodes[i]);
+                }
+                for (size_t d = 0; d < dimensions; ++d)
+                {
+                    WriteValue(buffer, node.pos[d]);
+                    WriteValue(buffer, node.size[d]);
+                }
+                WriteValue(buffer, uint64_t(node.level));
+                WriteValue(buffer, firstChild);
+                WriteValue(buffer, childPage);
+                WriteValue(buffer, uint64_t(node.items.size()));
+                for (size_t item : node.items)
+                {
+                    WriteValue(buffer, uint64_t(item));
+                    const VecN point = Point(item);
+                    for (size_t d = 0; d < dimensions; ++d)
+                        WriteValue(buffer, point[d]);
+                }
+            }
+            const std::string bytes = buffer.str();
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            directory.push_back({ offset, bytes.size(), nodes.size() });
+            offset += bytes.size();
+        }
+
+        WriteValue(out, uint64_t(directory.size()));
+        for (size_t page = 0; page < directory.size(); ++page)
+        {
+            for (uint64_t value : directory[page])
+                WriteValue(out, value);
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                WriteValue(out, mNodes[roots[page]].pos[d]);
+                WriteValue(out, mNodes[roots[page]].size[d]);
+            }
+        }
+        WriteValue(out, offset);
+        if (!out)
+            throw std::runtime_error("Orthtree error: Failed to write the tree.");
+    }
+
+    // Gets the deepest node having both a and b in its subtree (a node is in its own subtree)
+    [[nodiscard]] size_t LowestCommonAncestor(size_t a, size_t b) const
+    {
+        if (a >= mNodes.size() || b >= mNodes.size())
+            throw std::out_of_range("Orthtree error: index " + std::to_string(std::max(a, b)) +
+                                    " is out of range. Tree size is " + std::to_string(mNodes.size()));
+        while (mNodes[a].level > mNodes[b].level)
+            a = Parent(a);
+        while (mNodes[b].level > mNodes[a].level)
+            b = Parent(b);
+        while (a != b)
+        {
+            a = Parent(a);
+            b = Parent(b);
+        }
+        return a;
+    }
+
+    // Builds the tree breadth first. Each level's subdivision conditions are evaluated
+    // before any of its nodes are split, in parallel when a thread pool has been set, so
+    // subdivisionCondition must then be safe to call concurrently.
+    void Generate(VecN lowerBounds,
+                  VecN upperBounds,
+                  size_t maxDepth,
+                  std::function<bool(Node&)> subdivisionCondition)
+    {
+        mPoints.clear();
+        mPayload.clear();
+        mView = PointView();
+        mExternal = false;
+        mBucketCapacity = npos;
+        mMaxDepth = maxDepth;
+        Build(lowerBounds, upperBounds, maxDepth, subdivisionCondition);
+    }
+
+    // Builds a point-region tree over a copy of points, subdividing every node which holds
+    // more than bucketCapacity of them. Leaves list their points in Node::items. Points
+    // outside [lowerBounds, upperBounds) are wrapped along periodic axes and otherwise not stored.
+    void Generate(VecN lowerBounds,
+                  VecN upperBounds,
+                  size_t maxDepth,
+                  const std::vector<VecN>& points,
+                  size_t bucketCapacity)
+    {
+        mView = PointView();
+        mExternal = false;
+        VecN extent = upperBounds;
+        for (size_t d = 0; d < dimensions; ++d)
+            extent[d] -= lowerBounds[d];
+        mPoints = points;
+        mPayload.clear();
+        if (IsPeriodic())
+            for (VecN& point : mPoints)
+                point = Wrap(point, lowerBounds, extent);
+        mBucketCapacity = bucketCapacity;
+        mMaxDepth = maxDepth;
+        Build(lowerBounds, upperBounds, maxDepth, [bucketCapacity](const Node& node) {
+            return node.items.size() > bucketCapacity;
+        });
+        if constexpr (compactPoints)
+        {
+            mPayload.resize(mPoints.size());
+            for (size_t item = 0; item < mPoints.size(); ++item)
+                Encode(item, mPoints[item], Anchor(item));
+            std::vector<VecN>().swap(mPoints);
+        }
+    }
+
+    // Builds a point-region tree over points held by the caller, without copying them. The
+    // tree stores only indices into the view, whose buffers must outlive it and stay unchanged
+    // while it is used; Insert, MovePoint and ReorderPoints are not available. Points outside
+    // the bounds are placed by their wrapped position along periodic axes, and otherwise not stored.
+    void Generate(VecN lowerBounds,
+                  VecN upperBounds,
+                  size_t maxDepth,
+                  const PointView& points,
+                  size_t bucketCapacity)
+    {
+        mPoints.clear();
+        mPayload.clear();
+        mView = points;
+        mExternal = true;
+        mBucketCapacity = bucketCapacity;
+        mMaxDepth = maxDepth;
+        Build(lowerBounds, upperBounds, maxDepth, [bucketCapacity](const Node& node) {
+            return node.items.size() > bucketCapacity;
+        });
+    }
+
+    // Gets the points owned by a point-region tree. Empty when it views the caller's points
+    // or stores them as PointT, use Point and NumPoints instead.
+    [[nodiscard]] const std::vector<VecN>& Points() const noexcept
+    {
+        return mPoints;
+    }
+
+    // Gets a stored point, whether owned, compact or viewed
+    [[nodiscard]] VecN Point(size_t item) const
+    {
+        if (mExternal)
+            return mView[item];
+        if (mQuantized && mQuantized->stored)
+            return QuantizedPoint(item);
+        if (IsCompact())
+        {
+            VecN point = Anchor(item);
+            for (size_t d = 0; d < dimensions; ++d)
+                point[d] += static_cast<T>(mPayload[item][d]);
+            return point;
+        }
+        return mPoints[item];
+    }
+
+    [[nodiscard]] size_t NumPoints() const noexcept
+    {
+        if (mExternal)
+            return mView.count;
+        if (mQuantized && mQuantized->stored)
+            return mLeafOf.size();
+        return IsCompact() ? mPayload.size() : mPoints.size();
+    }
+
+    // Gets the index of the leaf holding a stored point, or npos if it lies outside the tree
+    [[nodiscard]] size_t LeafOf(size_t item) const
+    {
+        return mLeafOf.at(item);
+    }
+
+    // Adds a point to a point-region tree and returns its index. The leaf receiving it is
+    // split, as are its children in turn, while it holds more than bucketCapacity points and
+    // lies above maxDepth. A point outside the tree first grows the root outward by doubling,
+    // keeping the existing nodes.
+    size_t Insert(const VecN& point)
+    {
+        if (mNodes.empty())
+            throw std::logic_error("Orthtree error: Cannot insert into a tree which has not been generated.");
+        RequireOwnedPoints();
+        const VecN wrapped = Wrap(point);
+        if (!mNodes[0].ContainsPoint(wrapped))
+            GrowToContain(wrapped);
+        size_t leaf = Locate(wrapped);
+        DropQuantized();
+        size_t item = NumPoints();
+        if (IsCompact())
+            mPayload.emplace_back();
+        else
+            mPoints.emplace_back();
+        mLeafOf.push_back(leaf);
+        StorePoint(item, wrapped);
+        mNodes[leaf].items.push_back(item);
+        SplitOverfull(leaf);
+        return item;
+    }
+
+    // Moves a stored point, relinking it to the leaf containing its new position. In a
+    // point-region tree that leaf is split if it now holds more than bucketCapacity points,
+    // and the leaf it left is merged with its siblings once they hold bucketCapacity points or
+    // fewer between them, so node indices may change. Points moved outside the tree are kept
+    // but no longer found by queries until moved back.
+    void MovePoint(size_t item, const VecN& newPosition)
+    {
+        RequireOwnedPoints();
+        size_t from = mLeafOf.at(item);
+        const VecN position = Wrap(newPosition);
+        DropQuantized();
+        if (from != npos && mNodes[from].ContainsPoint(position))
+        {
+            StorePoint(item, position);
+            return;
+        }
+        if (from != npos)
+        {
+            auto& items = mNodes[from].items;
+            *std::find(items.begin(), items.end(), item) = items.back();
+            items.pop_back();
+        }
+        size_t to = Locate(position);
+        if (to != npos)
+            mNodes[to].items.push_back(item);
+        mLeafOf[item] = to;
+        StorePoint(item, position);
+        if (mBucketCapacity == npos)
+            return;
+        if (to != npos)
+            SplitOverfull(to);
+        if (from != npos && mNodes[from].isLeaf)
+            MergeUnderfull(from);
+    }
+
+    // Gets the stored points in the order their leaves are met depth first, which is Morton
+    // order. Entry i is the index of the point which goes to position i; points outside the
+    // tree come last.
+    [[nodiscard]] std::vector<size_t> GetPermutation() const
+    {
+        std::vector<size_t> permutation;
+        permutation.reserve(NumPoints());
+        for (size_t leaf : CollectLeaves([](const Node&) { return true; }))
+            permutation.insert(permutation.end(), mNodes[leaf].items.begin(), mNodes[leaf].items.end());
+        for (size_t item = 0; item < mLeafOf.size(); ++item)
+            if (mLeafOf[item] == npos)
+                permutation.push_back(item);
+        return permutation;
+    }
+
+    // Reorders arrays in place so that element i becomes the old element permutation[i]. Any
+    // number of arrays indexable by size_t (vectors, pointers, ...) can be given, e.g. all the
+    // attribute arrays of a structure of arrays. Each array is permuted by following the cycles
+    // of the permutation, moving every element once.
+    template<typename... Arrays>
+    static void Permute(const std::vector<size_t>& permutation, Arrays&&... arrays)
+    {
+        std::vector<bool> done(permutation.size());
+        auto permuteOne = [&](auto&& array) {
+            done.assign(permutation.size(), false);
+            for (size_t start = 0; start < permutation.size(); ++start)
+            {
+                if (done[start])
+                    continue;
+                auto first = std::move(array[start]);
+                size_t i = start;
+                for (; permutation[i] != start; i = permutation[i])
+                {
+                    array[i] = std::move(array[permutation[i]]);
+                    done[i] = true;
+                }
+                array[i] = std::move(first);
+                done[i] = true;
+            }
+        };
+        (permuteOne(arrays), ...);
+    }
+
+    // Reorders the stored points into leaf order (see GetPermutation) so that each leaf's
+    // points are contiguous, renumbering the leaves' items to match. Returns the permutation,
+    // for reordering the caller's own per-point data with Permute.
+    std::vector<size_t> ReorderPoints()
+    {
+        RequireOwnedPoints();
+        DropQuantized();
+        std::vector<size_t> permutation = GetPermutation();
+        if (IsCompact())
+            Permute(permutation, mPayload, mLeafOf);
+        else
+            Permute(permutation, mPoints, mLeafOf);
+        size_t next = 0;
+        for (size_t leaf : CollectLeaves([](const Node&) { return true; }))
+            for (size_t& item : mNodes[leaf].items)
+                item = next++;
+        ++mVersion;
+        return permutation;
+    }
+
+    // Stores the points as 8 or 16 bit offsets within their leaf's box (0 goes back to full
+    // precision). Points the tree owns at full precision are replaced by their codes, read
+    // back as the centre of their code's cell, which takes a quarter or half of the memory
+    // of float coordinates. With a PointT payload or points viewed from the caller's buffers the codes are
+    // kept in front of those, which stay exact: radius and nearest neighbour queries bound
+    // distances from the codes and read the exact coordinates only for points the bounds
+    // cannot settle. Inserting, moving or reordering points goes back to full precision
+    // points, at their decoded positions for codes stored in their place. Integer coordinates
+    // are quantized in double and decode to the smallest integer of their cell.
+    void QuantizePoints(unsigned bits)
+    {
+        if (bits != 0 && bits != 8 && bits != 16)
+            throw std::invalid_argument("Orthtree error: Points can only be quantized to 8 or 16 bits.");
+        RequireLoaded();
+        DropQuantized();
+        if (bits == 0)
+            return;
+        QuantizedPoints quantized;
+        quantized.bits = bits;
+        quantized.stored = !mExternal && !IsCompact();
+        quantized.codes8.resize(bits == 8 ? NumPoints() * dimensions : 0);
+        quantized.codes16.resize(bits == 16 ? NumPoints() * dimensions : 0);
+
+        const double levels = static_cast<double>(size_t(1) << bits);
+        ParallelFor(0, mNodes.size(), [&](size_t i) {
+            const Node& node = mNodes[i];
+            for (size_t item : node.items)
+            {
+                const VecN point = WrappedPoint(item);
+                for (size_t d = 0; d < dimensions; ++d)
+                {
+                    // Scaled before dividing, so that integer points on a cell's edge get exact codes
+                    double offset = node.size[d] > 0 ?
+                        static_cast<double>(point[d] - node.pos[d]) * levels / static_cast<double>(node.size[d]) : 0.0;
+                    auto code = static_cast<uint16_t>(std::clamp(std::floor(offset), 0.0, levels - 1));
+                    if (bits == 8)
+                        quantized.codes8[item * dimensions + d] = static_cast<uint8_t>(code);
+                    else
+                        quantized.codes16[item * dimensions + d] = code;
+                }
+            }
+        });
+        if (quantized.stored)
+        {
+            for (size_t item = 0; item < mLeafOf.size(); ++item)
+                if (mLeafOf[item] == npos)
+                    quantized.outside.emplace(item, mPoints[item]);
+            std::vector<VecN>().swap(mPoints);
+        }
+        mQuantized = std::move(quantized);
+    }
+
+    // Bytes taken by the quantized codes and the points they could not hold, or 0 when points
+    // are not quantized
+    [[nodiscard]] size_t QuantizedBytes() const noexcept
+    {
+        if (!mQuantized)
+            return 0;
+        return mQuantized->codes8.size() + mQuantized->codes16.size() * sizeof(uint16_t) +
+               mQuantized->outside.size() * (sizeof(size_t) + sizeof(VecN));
+    }
+
+    // Gets the index of the leaf containing point, or npos if it lies outside the tree
+    [[nodiscard]] size_t Locate(const VecN& queryPoint) const
+    {
+        const VecN point = Wrap(queryPoint);
+        if (mNodes.empty() || !mNodes[0].ContainsPoint(point))
+            return npos;
+        size_t index = 0;
+        while (!mNodes[index].isLeaf)
+            index = ChildContaining(mNodes[index], point);
+        return index;
+    }
+
+    // Locate for many points at once. Descents are interleaved to overlap their cache
+    // misses and the batch is split across the thread pool if one is set.
+    [[nodiscard]] std::vector<size_t> LocateBatch(const std::vector<VecN>& points) const
+    {
+        return LocateAll(points.data(), points.size());
+    }
+
+    // LocateBatch over points held by the caller
+    [[nodiscard]] std::vector<size_t> LocateBatch(const PointView& points) const
+    {
+        return LocateAll(points, points.count);
+    }
+
+    // Gets the indices of all leaves overlapping the box [lowerBounds, upperBounds], in
+    // depth-first (Morton) order. Children are prefetched as they are pushed on the stack
+    // and only tested once popped, by which time their cache lines have usually arrived.
+    [[nodiscard]] std::vector<size_t> QueryRange(const VecN& lowerBounds, const VecN& upperBounds) const
+    {
+        return CollectLeaves([&](const Node& node) {
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                if (mPeriodic[d])
+                {
+                    // Test the images of the box one period either side as well
+                    const T period = mNodes[0].size[d];
+                    bool overlaps = upperBounds[d] - lowerBounds[d] >= period;
+                    for (int shift = -1; shift <= 1 && !overlaps; ++shift)
+                        overlaps = upperBounds[d] + static_cast<T>(shift) * period >= node.pos[d] &&
+                                   lowerBounds[d] + static_cast<T>(shift) * period < node.pos[d] + node.size[d];
+                    if (!overlaps)
+                        return false;
+                }
+                else if (upperBounds[d] < node.pos[d] || lowerBounds[d] >= node.pos[d] + node.size[d])
+                    return false;
+            }
+            return true;
+        });
+    }
+
+    // Gets the indices of all leaves overlapping the sphere around centre, in depth-first order
+    [[nodiscard]] std::vector<size_t> QueryRadius(const VecN& centre, T radius) const
+    {
+        return CollectLeaves([&](const Node& node) {
+            return BoxDistanceSqr(node, centre) <= radius * radius;
+        });
+    }
+
+    // Gets the indices of the k stored points closest to point, nearest first
+    [[nodiscard]] std::vector<size_t> KNearest(const VecN& point, size_t k) const
+    {
+        return KNearestApprox(point, k, static_cast<T>(0));
+    }
+
+    // Approximate k nearest neighbours: every returned distance is within a factor of
+    // (1 + epsilon) of the true i-th nearest distance, because nodes closer than the current
+    // k-th distance divided by (1 + epsilon) are the only ones visited. The search also stops
+    // after maxLeaves leaves, which bounds its latency at the cost of that guarantee.
+    [[nodiscard]] std::vector<size_t> KNearestApprox(const VecN& point, size_t k, T epsilon,
+                                                     size_t maxLeaves = npos) const
+    {
+        using Candidate = std::pair<T, size_t>;
+        std::vector<Candidate> nearest, queue;     // max-heap of found points, min-heap of nodes
+        std::vector<QuantizedScalar> lower, upper;
+        auto closer = [](const Candidate& a, const Candidate& b) { return a.first > b.first; };
+        const T scale = (static_cast<T>(1) + epsilon) * (static_cast<T>(1) + epsilon);
+        if (mNodes.empty() || !k)
+            return {};
+        queue.push_back({ BoxDistanceSqr(mNodes[0], point), 0 });
+        for (size_t leaves = 0; !queue.empty() && leaves < maxLeaves;)
+        {
+            std::pop_heap(queue.begin(), queue.end(), closer);
+            auto [boxDistSqr, index] = queue.back();
+            queue.pop_back();
+            if (nearest.size() == k && boxDistSqr * scale > nearest.front().first)
+                break;
+            const Node& node = mNodes[index];
+            if (node.isLeaf)
+            {
+                ++leaves;
+                // Once k points are known, codes rule out most points without reading them
+                const bool bounded = mQuantized && nearest.size() == k;
+                if (bounded)
+                    QuantizedDistanceBounds(index, point, lower, upper);
+                for (size_t j = 0; j < node.items.size(); ++j)
+                {
+                    if (bounded && lower[j] >= static_cast<QuantizedScalar>(nearest.front().first))
+                        continue;
+                    size_t item = node.items[j];
+                    T distSqr = PointDistanceSqr(point, Point(item));
+                    if (nearest.size() < k)
+                        nearest.push_back({ distSqr, item });
+                    else if (distSqr < nearest.front().first)
+                    {
+                        std::pop_heap(nearest.begin(), nearest.end());
+                        nearest.back() = { distSqr, item };
+                    }
+                    else
+                        continue;
+                    std::push_heap(nearest.begin(), nearest.end());
+                }
+                continue;
+            }
+            for (size_t i = 0; i < numChildren; ++i)
+            {
+                T childDistSqr = BoxDistanceSqr(mNodes[node.firstChild + i], point);
+                if (nearest.size() == k && childDistSqr * scale > nearest.front().first)
+                    continue;
+                queue.push_back({ childDistSqr, node.firstChild + i });
+                std::push_heap(queue.begin(), queue.end(), closer);
+                PrefetchContents(mNodes[node.firstChild + i]);
+            }
+        }
+        std::sort_heap(nearest.begin(), nearest.end());
+        std::vector<size_t> result;
+        result.reserve(nearest.size());
+        for (auto& candidate : nearest)
+            result.push_back(candidate.second);
+        return result;
+    }
+
+    // Gets the indices of all stored points within radius of centre
+    [[nodiscard]] std::vector<size_t> PointsInRadius(const VecN& centre, T radius) const
+    {
+        std::vector<size_t> result;
+        ForEachPointInRadius(centre, radius, [&](size_t item) {
+            result.push_back(item);
+            return true;
+        });
+        return result;
+    }
+
+    // Labels every stored point with its DBSCAN cluster (0, 1, ...) or npos for noise. A point
+    // is core when at least minPoints points (itself included) lie within eps. Leaves whose
+    // diagonal is at most eps and which hold minPoints points are all core without a query, and
+    // leaves entirely within eps of a point are counted without distance tests. Core detection
+    // and cluster merging run on the thread pool.
+    [[nodiscard]] std::vector<size_t> Dbscan(T eps, size_t minPoints) const
+    {
+        const size_t numPoints = NumPoints();
+        std::vector<size_t> labels(numPoints, npos);
+        const std::vector<size_t> leaves = CollectLeaves([](const Node& node) {
+            return !node.isLeaf || !node.items.empty();
+        });
+
+        // Find the core points
+        std::vector<char> isCore(numPoints, 0);
+        ParallelFor(0, leaves.size(), [&](size_t l) {
+            const Node& leaf = mNodes[leaves[l]];
+            T diagonalSqr = static_cast<T>(0);
+            for (size_t d = 0; d < dimensions; ++d)
+                diagonalSqr += leaf.size[d] * leaf.size[d];
+            if (diagonalSqr <= eps * eps && leaf.items.size() >= minPoints)
+            {
+                for (size_t item : leaf.items)
+                    isCore[item] = 1;
+                return;
+            }
+            for (size_t item : leaf.items)
+            {
+                size_t count = 0;
+                ForEachLeafInRadius(Point(item), eps, [&](const Node& other, bool whole) {
+                    if (whole)
+                        count += other.items.size();
+                    else
+                        for (size_t neighbour : other.items)
+                            count += PointDistanceSqr(Point(item), Point(neighbour)) <= eps * eps;
+                    return count < minPoints;
+                });
+                isCore[item] = count >= minPoints;
+            }
+        });
+
+        // Merge core points within eps of each other
+        DisjointSets sets(numPoints);
+        ParallelFor(0, leaves.size(), [&](size_t l) {
+            const Node& leaf = mNodes[leaves[l]];
+            for (size_t item : leaf.items)
+            {
+                if (!isCore[item])
+                    continue;
+                ForEachPointInRadius(Point(item), eps, [&](size_t neighbour) {
+                    if (isCore[neighbour] && sets.Find(neighbour) != sets.Find(item))
+                        sets.Unite(item, neighbour);
+                    return true;
+                });
+            }
+        });
+
+        // Number the clusters and attach border points to the cluster of a core neighbour
+        std::vector<size_t> clusterOf(numPoints, npos);
+        size_t numClusters = 0;
+        for (size_t i = 0; i < numPoints; ++i)
+        {
+            if (!isCore[i])
+                continue;
+            size_t root = sets.Find(i);
+            if (clusterOf[root] == npos)
+                clusterOf[root] = numClusters++;
+            labels[i] = clusterOf[root];
+        }
+        ParallelFor(0, leaves.size(), [&](size_t l) {
+            for (size_t item : mNodes[leaves[l]].items)
+            {
+                if (isCore[item])
+                    continue;
+                ForEachPointInRadius(Point(item), eps, [&](size_t neighbour) {
+                    if (!isCore[neighbour])
+                        return true;
+                    labels[item] = labels[neighbour];
+                    return false;
+                });
+            }
+        });
+        return labels;
+    }
+
+    // Gets the HDBSCAN core distance of every stored point: the distance to its minPoints-th
+    // nearest point, itself included, or infinity (max for integral T) if there are not enough
+    [[nodiscard]] std::vector<T> CoreDistances(size_t minPoints) const
+    {
+        const T unreachable = std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                                   : std::numeric_limits<T>::max();
+        std::vector<T> distances(NumPoints(), unreachable);
+        if (minPoints <= 1)
+        {
+            std::fill(distances.begin(), distances.end(), static_cast<T>(0));
+            return distances;
+        }
+        const size_t k = minPoints - 1;
+        const std::vector<size_t> graph = BuildKnnGraph(k);
+        ParallelFor(0, NumPoints(), [&](size_t i) {
+            if (graph[i * k + k - 1] != npos)
+                distances[i] = static_cast<T>(std::sqrt(PointDistanceSqr(Point(i), Point(graph[i * k + k - 1]))));
+        });
+        return distances;
+    }
+
+    // Computes the k nearest neighbours (excluding itself) of every stored point. Row i of the
+    // returned row-major Points().size() x k matrix lists the neighbours of point i nearest
+    // first, padded with npos when fewer exist. Leaves are processed in parallel and all
+    // points of a leaf share one search for the leaves that can hold their neighbours.
+    [[nodiscard]] std::vector<size_t> BuildKnnGraph(size_t k) const
+    {
+        std::vector<size_t> graph(NumPoints() * k, npos);
+        if (!k)
+            return graph;
+        const std::vector<size_t> leaves = CollectLeaves([](const Node& node) {
+            return !node.isLeaf || !node.items.empty();
+        });
+        ParallelFor(0, leaves.size(), [&](size_t l) {
+            using Candidate = std::pair<T, size_t>;
+            const Node& leaf = mNodes[leaves[l]];
+            auto closer = [](const Candidate& a, const Candidate& b) { return a.first > b.first; };
+            std::vector<std::vector<Candidate>> nearest(leaf.items.size());
+            auto add = [&](size_t p, size_t other) {
+                if (other == leaf.items[p])
+                    return;
+                auto& heap = nearest[p];
+                T distSqr = PointDistanceSqr(Point(leaf.items[p]), Point(other));
+                if (heap.size() < k)
+                    heap.push_back({ distSqr, other });
+                else if (distSqr < heap.front().first)
+                {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.back() = { distSqr, other };
+                }
+                else
+                    return;
+                std::push_heap(heap.begin(), heap.end());
+            };
+
+            // Gathers the other leaves in order of their distance to this leaf, until more than
+            // minPoints points have been seen and the next leaf is further away than bound
+            std::vector<Candidate> queue{ { static_cast<T>(0), 0 } };
+            std::vector<size_t> candidates;
+            size_t seen = leaf.items.size();
+            auto gather = [&](T bound, size_t minPoints) {
+                while (!queue.empty() && (seen <= minPoints || queue.front().first <= bound))
+                {
+                    std::pop_heap(queue.begin(), queue.end(), closer);
+                    size_t index = queue.back().second;
+                    queue.pop_back();
+                    const Node& node = mNodes[index];
+                    if (node.isLeaf)
+                    {
+                        if (&node == &leaf)
+                            continue;
+                        candidates.push_back(index);
+                        seen += node.items.size();
+                        continue;
+                    }
+                    for (size_t i = 0; i < numChildren; ++i)
+                    {
+                        const Node& child = mNodes[node.firstChild + i];
+                        if (child.isLeaf && child.items.empty())
+                            continue;
+                        queue.push_back({ BoxBoxDistanceSqr(leaf, child), node.firstChild + i });
+                        std::push_heap(queue.begin(), queue.end(), closer);
+                        PrefetchContents(child);
+                    }
+                }
+            };
+
+            // This leaf and the closest leaves holding k other points give every point a k-th
+            // distance bound. Only leaves within the largest bound can improve on it.
+            gather(static_cast<T>(0), k);
+            T bound = static_cast<T>(0);
+            for (size_t p = 0; p < leaf.items.size(); ++p)
+            {
+                for (size_t other : leaf.items)
+                    add(p, other);
+                for (size_t index : candidates)
+                    for (size_t other : mNodes[index].items)
+                        add(p, other);
+                bound = nearest[p].size() < k ? std::numeric_limits<T>::max()
+                                              : std::max(bound, nearest[p].front().first);
+            }
+            const size_t numSeeded = candidates.size();
+            gather(bound, 0);
+
+            // Each point scans the remaining leaves nearest first and stops at its k-th distance
+            std::vector<Candidate> order;
+            for (size_t p = 0; p < leaf.items.size(); ++p)
+            {
+                const VecN point = Point(leaf.items[p]);
+                auto& heap = nearest[p];
+                order.clear();
+                for (size_t c = numSeeded; c < candidates.size(); ++c)
+                {
+                    T boxDistSqr = BoxDistanceSqr(mNodes[candidates[c]], point);
+                    if (heap.size() < k || boxDistSqr <= heap.front().first)
+                        order.push_back({ boxDistSqr, candidates[c] });
+                }
+                std::sort(order.begin(), order.end());
+                for (auto& [boxDistSqr, index] : order)
+                {
+                    if (heap.size() == k && boxDistSqr > heap.front().first)
+                        break;
+                    for (size_t other : mNodes[index].items)
+                        add(p, other);
+                }
+                std::sort_heap(heap.begin(), heap.end());
+                for (size_t j = 0; j < heap.size(); ++j)
+                    graph[leaf.items[p] * k + j] = heap[j].second;
+            }
+        });
+        return graph;
+    }
+
+    // Caches the results of CachedQueryRange and CachedQueryRadius, evicting the least
+    // recently used lists once they take up more than maxBytes. 0 disables the cache.
+    void EnableQueryCache(size_t maxBytes)
+    {
+        if (!maxBytes)
+        {
+            mCache.reset();
+            return;
+        }
+        if (!mCache)
+            mCache.emplace();
+        std::lock_guard<std::mutex> lock(mCache->mutex);
+        mCache->maxBytes = maxBytes;
+        while (mCache->usedBytes > maxBytes)
+            mCache->Erase(std::prev(mCache->entries.end()));
+    }
+
+    // Drops cached results whose query region overlaps the box [lowerBounds, upperBounds].
+    // Rebuilding the tree invalidates the whole cache by itself.
+    void InvalidateRegion(const VecN& lowerBounds, const VecN& upperBounds)
+    {
+        if (!mCache)
+            return;
+        std::lock_guard<std::mutex> lock(mCache->mutex);
+        ++mCache->invalidations;
+        for (auto it = mCache->entries.begin(); it != mCache->entries.end();)
+        {
+            const auto& key = (it++)->key;
+            bool overlaps = true;
+            for (size_t d = 0; d < dimensions && overlaps; ++d)
+            {
+                T lower = key.params[d], upper = key.params[dimensions + d];
+                if (key.shape == QueryCache::Shape::Sphere)
+                {
+                    lower = key.params[d] - key.params[dimensions];
+                    upper = key.params[d] + key.params[dimensions];
+                }
+                overlaps = lower <= upperBounds[d] && lowerBounds[d] <= upper;
+            }
+            if (overlaps)
+                mCache->Erase(std::prev(it));
+        }
+    }
+
+    // QueryRange through the query cache. Repeated queries return the same shared list.
+    [[nodiscard]] std::shared_ptr<const std::vector<size_t>> CachedQueryRange(const VecN& lowerBounds,
+                                                                              const VecN& upperBounds) const
+    {
+        typename QueryCache::Key key{ QueryCache::Shape::Box, {} };
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            key.params[d] = lowerBounds[d];
+            key.params[dimensions + d] = upperBounds[d];
+        }
+        return CachedQuery(key, [&] { return QueryRange(lowerBounds, upperBounds); });
+    }
+
+    // QueryRadius through the query cache. Repeated queries return the same shared list.
+    [[nodiscard]] std::shared_ptr<const std::vector<size_t>> CachedQueryRadius(const VecN& centre, T radius) const
+    {
+        typename QueryCache::Key key{ QueryCache::Shape::Sphere, {} };
+        for (size_t d = 0; d < dimensions; ++d)
+            key.params[d] = centre[d];
+        key.params[dimensions] = radius;
+        return CachedQuery(key, [&] { return QueryRadius(centre, radius); });
+    }
+
+    // Per-leaf Verlet neighbour lists for particle simulations. Every leaf holding particles
+    // gets one list of all particles within cutoff + skin of its box, which stays valid while
+    // every particle stays within skin / 2 of where it was when it was last listed. Update
+    // moves the particles which went further in the tree, which splits and merges leaves as
+    // needed, and rebuilds only the lists of the leaves they left or entered; other lists just
+    // swap the moved particles' entries. The tree must outlive the lists and is modified by Update.
+    class VerletList
+    {
+    public:
+        VerletList(Orthtree& tree, T cutoff, T skin) : mTree(tree), mCutoff(cutoff), mSkin(skin)
+        {
+            mReference.resize(mTree.NumPoints());
+            for (size_t i = 0; i < mReference.size(); ++i)
+                mReference[i] = mTree.Point(i);
+            Regroup({});
+        }
+
+        // Feeds the particles' current positions (indexed like the tree's points). Returns
+        // true if any list had to be rebuilt.
+        bool Update(const std::vector<VecN>& positions)
+        {
+            if (positions.size() != mReference.size())
+                throw std::invalid_argument("Orthtree error: VerletList expects " + std::to_string(mReference.size()) +
+                                            " positions, got " + std::to_string(positions.size()));
+            const T limitSqr = mSkin * mSkin / static_cast<T>(4);
+            std::vector<char> moved(positions.size());
+            mTree.ParallelFor(0, positions.size(), [&](size_t i) {
+                moved[i] = mTree.PointDistanceSqr(positions[i], mReference[i]) > limitSqr;
+            });
+            std::vector<size_t> movers;
+            for (size_t i = 0; i < positions.size(); ++i)
+                if (moved[i])
+                    movers.push_back(i);
+            if (movers.empty())
+                return false;
+
+            // The lists the movers leave are rebuilt, the others are patched
+            std::unordered_map<size_t, size_t> oldGroup;
+            for (size_t g = 0; g < mGroups.size(); ++g)
+                oldGroup.emplace(mLeaves[g].leaf, g);
+            std::vector<char> dirty(mGroups.size());
+            for (size_t i : movers)
+            {
+                auto found = oldGroup.find(mTree.LeafOf(i));
+                if (found != oldGroup.end())
+                    dirty[found->second] = true;
+            }
+            std::vector<VecN> oldReference;
+            for (size_t i : movers)
+            {
+                oldReference.push_back(mReference[i]);
+                mTree.MovePoint(i, positions[i]);
+                mReference[i] = mTree.Point(i);
+            }
+            Regroup(std::move(oldGroup), dirty, moved, movers, oldReference);
+            return true;
+        }
+
+        // Calls fn(i, j, distanceSqr) for every ordered pair of distinct particles closer than
+        // the cutoff at positions. Groups run in parallel and each i belongs to one group, so fn
+        // may write to per-i state without locking.
+        template<typename F>
+        void ForEachPair(const std::vector<VecN>& positions, F&& fn) const
+        {
+            const T cutoffSqr = mCutoff * mCutoff;
+            mTree.ParallelFor(0, mGroups.size(), [&](size_t g) {
+                for (size_t i : mGroups[g])
+                    for (size_t j : mCandidates[g])
+                    {
+                        if (i == j)
+                            continue;
+                        T dSqr = mTree.PointDistanceSqr(positions[i], positions[j]);
+                        if (dSqr < cutoffSqr)
+                            fn(i, j, dSqr);
+                    }
+            });
+        }
+
+        [[nodiscard]] size_t NumGroups() const noexcept
+        {
+            return mGroups.size();
+        }
+
+        // Particles of a leaf at the time the lists were built
+        [[nodiscard]] const std::vector<size_t>& Group(size_t group) const
+        {
+            return mGroups.at(group);
+        }
+
+        // Particles which may come within the cutoff of any particle of a group
+        [[nodiscard]] const std::vector<size_t>& Candidates(size_t group) const
+        {
+            return mCandidates.at(group);
+        }
+
+        // Number of lists rebuilt by the last Update, or by the constructor
+        [[nodiscard]] size_t NumRebuilt() const noexcept
+        {
+            return mNumRebuilt;
+        }
+
+    private:
+        // A leaf's box when its list was built, which tells whether splits or merges replaced it
+        struct LeafBox
+        {
+            size_t leaf;
+            VecN pos, size;
+        };
+
+        // Lists every particle referenced within reach of the leaf's box
+        void Collect(size_t g)
+        {
+            const auto& nodes = mTree.mNodes;
+            const Node& leaf = nodes[mLeaves[g].leaf];
+            const T reach = mCutoff + mSkin;
+            mGroups[g] = leaf.items;
+            auto& candidates = mCandidates[g];
+            candidates.clear();
+            std::vector<size_t> stack{ 0 };
+            while (!stack.empty())
+            {
+                const Node& node = nodes[stack.back()];
+                stack.pop_back();
+                if (mTree.BoxBoxDistanceSqr(leaf, node) > reach * reach)
+                    continue;
+                if (!node.isLeaf)
+                {
+                    for (size_t i = 0; i < numChildren; ++i)
+                        stack.push_back(node.firstChild + i);
+                    continue;
+                }
+                for (size_t item : node.items)
+                    if (mTree.BoxDistanceSqr(leaf, mReference[item]) <= reach * reach)
+                        candidates.push_back(item);
+            }
+        }
+
+        // Matches the tree's leaves to the previous lists. A leaf keeps its list if it has the
+        // same index and box and neither lost nor gained movers; the movers are then only
+        // dropped from and re-added to the candidates of the lists within reach of them.
+        // Every other list is rebuilt.
+        void Regroup(std::unordered_map<size_t, size_t> oldGroup, const std::vector<char>& dirty = {},
+                     const std::vector<char>& moved = {}, const std::vector<size_t>& movers = {},
+                     const std::vector<VecN>& oldReference = {})
+        {
+            const auto& nodes = mTree.mNodes;
+            std::vector<std::vector<size_t>> groups, candidates;
+            std::vector<LeafBox> leaves;
+            std::vector<size_t> rebuild, groupOf(nodes.size(), npos);
+            for (size_t l = 0; l < nodes.size(); ++l)
+            {
+                const Node& leaf = nodes[l];
+                if (!leaf.isLeaf || leaf.items.empty())
+                    continue;
+                groupOf[l] = leaves.size();
+                leaves.push_back({ l, leaf.pos, leaf.size });
+                auto found = oldGroup.find(l);
+                bool kept = found != oldGroup.end() && !dirty[found->second];
+                if (kept)
+                {
+                    const LeafBox& box = mLeaves[found->second];
+                    for (size_t d = 0; d < dimensions; ++d)
+                        kept &= box.pos[d] == leaf.pos[d] && box.size[d] == leaf.size[d];
+                    for (size_t item : leaf.items)
+                        kept &= !moved[item];
+                }
+                if (kept)
+                {
+                    groups.push_back(std::move(mGroups[found->second]));
+                    candidates.push_back(std::move(mCandidates[found->second]));
+                }
+                else
+                {
+                    rebuild.push_back(groups.size());
+                    groups.emplace_back();
+                    candidates.emplace_back();
+                }
+            }
+            mGroups = std::move(groups);
+            mCandidates = std::move(candidates);
+            mLeaves = std::move(leaves);
+
+            // Kept lists swap their moved candidates for those now within reach
+            std::vector<char> isRebuilt(mGroups.size());
+            for (size_t g : rebuild)
+                isRebuilt[g] = true;
+            if (!movers.empty())
+            {
+                const T reach = mCutoff + mSkin;
+                std::vector<char> listed(mGroups.size());
+                for (const VecN& reference : oldReference)
+                    mTree.ForEachLeafInRadius(reference, reach, [&](const Node& leaf, bool) {
+                        listed[groupOf[static_cast<size_t>(&leaf - nodes.data())]] = true;
+                        return true;
+                    });
+                for (size_t g = 0; g < mGroups.size(); ++g)
+                    if (listed[g] && !isRebuilt[g])
+                    {
+                        auto& list = mCandidates[g];
+                        list.erase(std::remove_if(list.begin(), list.end(), [&](size_t j) { return moved[j]; }),
+                                   list.end());
+                    }
+                for (size_t i : movers)
+                    if (mTree.LeafOf(i) != npos)
+                        mTree.ForEachLeafInRadius(mReference[i], reach, [&](const Node& leaf, bool) {
+                            const size_t g = groupOf[static_cast<size_t>(&leaf - nodes.data())];
+                            if (!isRebuilt[g])
+                                mCandidates[g].push_back(i);
+                            return true;
+                        });
+            }
+            mTree.ParallelFor(0, rebuild.size(), [&](size_t r) { Collect(rebuild[r]); });
+            mNumRebuilt = rebuild.size();
+        }
+
+        Orthtree& mTree;
+        T mCutoff, mSkin;
+        std::vector<VecN> mReference;
+        std::vector<std::vector<size_t>> mGroups, mCandidates;
+        std::vector<LeafBox> mLeaves;
+        size_t mNumRebuilt = 0;
+    };
+
+    // Navigation graph over the free leaves of a region tree (e.g. one generated by subdividing
+    // around obstacles). Leaves are connected when they share a face, and edges cost the
+    // distance from one centre through the middle of the shared face (the portal) to the
+    // other. The graph is built once and patched by UpdateRegion when obstacles change; it is
+    // rebuilt on the next FindPath if the tree itself was regenerated.
+    class NavGraph
+    {
+    public:
+        NavGraph(const Orthtree& tree, std::function<bool(const Node&)> isBlocked) :
+                mTree(tree), mIsBlocked(std::move(isBlocked))
+        {
+            Rebuild();
+        }
+
+        // The graph keeps a reference to the tree, which must outlive it
+        NavGraph(Orthtree&& tree, std::function<bool(const Node&)> isBlocked) = delete;
+
+        // Re-evaluates the leaves overlapping [lowerBounds, upperBounds] and patches their edges
+        void UpdateRegion(const VecN& lowerBounds, const VecN& upperBounds)
+        {
+            if (mVersion != mTree.mVersion)
+            {
+                Rebuild();
+                return;
+            }
+            const std::vector<size_t> region = mTree.CollectLeaves([&](const Node& node) {
+                return Touches(node, lowerBounds, upperBounds);
+            });
+            for (size_t leaf : region)
+            {
+                for (const Edge& edge : mEdges[leaf])
+                {
+                    auto& back = mEdges[edge.leaf];
+                    back.erase(std::remove_if(back.begin(), back.end(), [&](const Edge& e) { return e.leaf == leaf; }),
+                               back.end());
+                }
+                mEdges[leaf].clear();
+                mBlocked[leaf] = mIsBlocked(mTree.mNodes[leaf]);
+            }
+            std::vector<char> inRegion(mTree.mNodes.size(), 0);
+            for (size_t leaf : region)
+                inRegion[leaf] = 1;
+            for (size_t leaf : region)
+                Connect(leaf, [&](size_t neighbour) { return !inRegion[neighbour]; });
+        }
+
+        // Finds the cheapest path between two points with A*. Returns the waypoints (start,
+        // the portals crossed and goal), or nothing if either end is blocked or unreachable.
+        // The leaves visited are written to leaves if given.
+        [[nodiscard]] std::vector<VecN> FindPath(const VecN& start, const VecN& goal,
+                                                 std::vector<size_t>* leaves = nullptr)
+        {
+            if (mVersion != mTree.mVersion)
+                Rebuild();
+            if (leaves)
+                leaves->clear();
+            const size_t from = mTree.Locate(start), to = mTree.Locate(goal);
+            if (from == npos || to == npos || mBlocked[from] || mBlocked[to])
+                return {};
+
+            using Candidate = std::pair<T, size_t>;
+            auto closer = [](const Candidate& a, const Candidate& b) { return a.first > b.first; };
+            const auto& nodes = mTree.mNodes;
+            std::unordered_map<size_t, std::pair<T, size_t>> visited;   // leaf -> (cost, previous leaf)
+            std::vector<Candidate> open{ { nodes[from].centre.Distance(goal), from } };
+            visited[from] = { start.Distance(nodes[from].centre), npos };
+            while (!open.empty())
+            {
+                std::pop_heap(open.begin(), open.end(), closer);
+                size_t leaf = open.back().second;
+                T estimate = open.back().first;
+                open.pop_back();
+                const T cost = visited[leaf].first;
+                if (estimate > cost + nodes[leaf].centre.Distance(goal))
+                    continue;   // stale entry
+                if (leaf == to)
+                    break;
+                for (const Edge& edge : mEdges[leaf])
+                {
+                    T next = cost + edge.cost;
+                    auto found = visited.find(edge.leaf);
+                    if (found != visited.end() && found->second.first <= next)
+                        continue;
+                    visited[edge.leaf] = { next, leaf };
+                    open.push_back({ next + nodes[edge.leaf].centre.Distance(goal), edge.leaf });
+                    std::push_heap(open.begin(), open.end(), closer);
+                }
+            }
+            if (!visited.count(to))
+                return {};
+
+            std::vector<size_t> path;
+            for (size_t leaf = to; leaf != npos; leaf = visited[leaf].second)
+                path.push_back(leaf);
+            std::reverse(path.begin(), path.end());
+            std::vector<VecN> waypoints{ start };
+            for (size_t i = 1; i < path.size(); ++i)
+                for (const Edge& edge : mEdges[path[i - 1]])
+                    if (edge.leaf == path[i])
+                    {
+                        waypoints.push_back(edge.portal);
+                        break;
+                    }
+            waypoints.push_back(goal);
+            if (leaves)
+                *leaves = std::move(path);
+            return waypoints;
+        }
+
+        [[nodiscard]] bool IsBlocked(size_t leaf) const
+        {
+            return mBlocked.at(leaf);
+        }
+
+    private:
+        struct Edge
+        {
+            size_t leaf;
+            VecN portal;
+            T cost;
+        };
+
+        // Closed-box test, so that leaves touching the region are included
+        static bool Touches(const Node& node, const VecN& lowerBounds, const VecN& upperBounds)
+        {
+            for (size_t d = 0; d < dimensions; ++d)
+                if (upperBounds[d] < node.pos[d] || lowerBounds[d] > node.pos[d] + node.size[d])
+                    return false;
+            return true;
+        }
+
+        void Rebuild()
+        {
+            mVersion = mTree.mVersion;
+            mEdges.assign(mTree.mNodes.size(), {});
+            mBlocked.assign(mTree.mNodes.size(), 1);
+            const std::vector<size_t> leaves = mTree.CollectLeaves([](const Node&) { return true; });
+            for (size_t leaf : leaves)
+                mBlocked[leaf] = mIsBlocked(mTree.mNodes[leaf]);
+            for (size_t leaf : leaves)
+                Connect(leaf, [](size_t) { return false; });
+        }
+
+        // Adds the edges from a free leaf to its free face neighbours, and the edges back for
+        // the neighbours which addReverse accepts (those that will not connect themselves)
+        template<typename AddReverse>
+        void Connect(size_t leaf, AddReverse&& addReverse)
+        {
+            if (mBlocked[leaf])
+                return;
+            const auto& nodes = mTree.mNodes;
+            const Node& a = nodes[leaf];
+            VecN upper = a.pos;
+            for (size_t d = 0; d < dimensions; ++d)
+                upper[d] += a.size[d];
+            const std::vector<size_t> nearby = mTree.CollectLeaves([&](const Node& node) {
+                return Touches(node, a.pos, upper);
+            });
+            for (size_t neighbour : nearby)
+            {
+                if (neighbour == leaf || mBlocked[neighbour])
+                    continue;
+                const Node& b = nodes[neighbour];
+                // Face neighbours touch along exactly one axis and overlap along all others
+                size_t touching = 0;
+                VecN portal;
+                for (size_t d = 0; d < dimensions; ++d)
+                {
+                    T low  = std::max(a.pos[d], b.pos[d]);
+                    T high = std::min(a.pos[d] + a.size[d], b.pos[d] + b.size[d]);
+                    T tolerance = std::numeric_limits<T>::epsilon() * 16 * nodes[0].size[d];
+                    if (high - low <= tolerance)
+                        ++touching;
+                    portal[d] = low + (high - low) / static_cast<T>(2);
+                }
+                if (touching != 1)
+                    continue;
+                T cost = a.centre.Distance(portal) + portal.Distance(b.centre);
+                mEdges[leaf].push_back({ neighbour, portal, cost });
+                if (addReverse(neighbour))
+                    mEdges[neighbour].push_back({ leaf, portal, cost });
+            }
+        }
+
+        const Orthtree& mTree;
+        std::function<bool(const Node&)> mIsBlocked;
+        uint64_t mVersion = 0;
+        std::vector<std::vector<Edge>> mEdges;
+        std::vector<char> mBlocked;
+    };
+
+    // Dense bricks of voxels held by the leaves of a region tree, so that subdivision can stop
+    // at the brick level: with bricks 2^log2Width voxels wide, a leaf at depth maxDepth has the
+    // resolution of a grid of 2^(maxDepth + log2Width) cells per axis. All bricks share one
+    // contiguous array, axis 0 varying fastest within a brick, so that loops and stencils
+    // inside a brick run over plain arrays. The bricks belong to the tree as it was built and
+    // must be reallocated once it is regenerated.
+    template<typename ValueT>
+    class BrickGrid
+    {
+    public:
+        // Gives a brick filled with value to every leaf for which hasBrick returns true
+        BrickGrid(const Orthtree& tree, size_t log2Width, const ValueT& value = ValueT(),
+                  const std::function<bool(const Node&)>& hasBrick = nullptr) :
+                mTree(tree), mVersion(tree.mVersion), mWidth(size_t(1) << log2Width)
+        {
+            static_assert(!std::is_same_v<ValueT, bool>, "Orthtree error: Use char bricks instead of bool.");
+            if (log2Width * dimensions >= sizeof(size_t) * 8 - 1)
+                throw std::invalid_argument("Orthtree error: Bricks are too wide.");
+            mBrickSize = size_t(1) << (log2Width * dimensions);
+            mBrickOf.assign(tree.mNodes.size(), npos);
+            size_t numBricks = 0;
+            for (size_t i = 0; i < tree.mNodes.size(); ++i)
+                if (tree.mNodes[i].isLeaf && (!hasBrick || hasBrick(tree.mNodes[i])))
+                    mBrickOf[i] = numBricks++;
+            mValues.assign(numBricks * mBrickSize, value);
+        }
+
+        // The bricks keep a reference to the tree, which must outlive them
+        BrickGrid(Orthtree&& tree, size_t log2Width, const ValueT& value = ValueT(),
+                  const std::function<bool(const Node&)>& hasBrick = nullptr) = delete;
+
+        // Number of voxels along each axis of a brick
+        [[nodiscard]] size_t Width() const noexcept
+        {
+            return mWidth;
+        }
+
+        [[nodiscard]] size_t BrickSize() const noexcept
+        {
+            return mBrickSize;
+        }
+
+        [[nodiscard]] size_t NumBricks() const noexcept
+        {
+            return mValues.size() / mBrickSize;
+        }
+
+        // Gets the BrickSize() voxels of a leaf, or nullptr if it has no brick
+        [[nodiscard]] ValueT* Brick(size_t leaf)
+        {
+            return const_cast<ValueT*>(std::as_const(*this).Brick(leaf));
+        }
+
+        [[nodiscard]] const ValueT* Brick(size_t leaf) const
+        {
+            CheckVersion();
+            size_t brick = mBrickOf.at(leaf);
+            return brick == npos ? nullptr : mValues.data() + brick * mBrickSize;
+        }
+
+        // Index within its leaf's brick of the voxel containing point
+        [[nodiscard]] size_t VoxelIndex(size_t leaf, const VecN& point) const
+        {
+            const Node& node = mTree.mNodes.at(leaf);
+            const VecN wrapped = mTree.Wrap(point);
+            size_t index = 0;
+            for (size_t d = dimensions; d-- > 0;)
+            {
+                double offset = node.size[d] > 0 ?
+                    static_cast<double>(wrapped[d] - node.pos[d]) / static_cast<double>(node.size[d]) * static_cast<double>(mWidth) : 0.0;
+                index = index * mWidth + static_cast<size_t>(std::clamp(std::floor(offset), 0.0, static_cast<double>(mWidth - 1)));
+            }
+            return index;
+        }
+
+        // Centre of a voxel of a leaf's brick
+        [[nodiscard]] VecN VoxelCentre(size_t leaf, size_t voxel) const
+        {
+            const Node& node = mTree.mNodes.at(leaf);
+            VecN centre;
+            for (size_t d = 0; d < dimensions; ++d, voxel /= mWidth)
+                centre[d] = node.pos[d] + node.size[d] * static_cast<T>(static_cast<double>(voxel % mWidth) + 0.5) /
+                                          static_cast<T>(mWidth);
+            return centre;
+        }
+
+        // Gets the voxel containing point, or nullptr if the point is outside the tree or in a
+        // leaf without a brick
+        [[nodiscard]] ValueT* At(const VecN& point)
+        {
+            return const_cast<ValueT*>(std::as_const(*this).At(point));
+        }
+
+        [[nodiscard]] const ValueT* At(const VecN& point) const
+        {
+            size_t leaf = mTree.Locate(point);
+            if (leaf == npos)
+                return nullptr;
+            const ValueT* brick = Brick(leaf);
+            return brick ? brick + VoxelIndex(leaf, point) : nullptr;
+        }
+
+        // Calls fn(leaf, values) for every brick, in parallel on the tree's thread pool
+        template<typename F>
+        void ForEachBrick(F&& fn)
+        {
+            CheckVersion();
+            mTree.ParallelFor(0, mBrickOf.size(), [&](size_t leaf) {
+                if (mBrickOf[leaf] != npos)
+                    fn(leaf, mValues.data() + mBrickOf[leaf] * mBrickSize);
+            });
+        }
+
+    private:
+        void CheckVersion() const
+        {
+            if (mVersion != mTree.mVersion)
+                throw std::logic_error("Orthtree error: The tree has changed since its bricks were allocated.");
+        }
+
+        const Orthtree& mTree;
+        uint64_t mVersion;
+        size_t mWidth, mBrickSize;
+        std::vector<size_t> mBrickOf;
+        std::vector<ValueT> mValues;
+    };
+
+    // Visits the leaves of an octree front to back, skipping subtrees which lie outside the
+    // view or behind the occluders in pyramid. viewProjection is a column-major (OpenGL style)
+    // matrix from world to clip space and eye is the camera position, used to order children.
+    // Calls fn(leaf, index) for every leaf which may be visible.
+    template<typename F>
+    void ForEachVisibleLeaf(const std::array<float, 16>& viewProjection, const VecN& eye,
+                            const OrthtreeDepthPyramid& pyramid, F&& fn) const
+    {
+        static_assert(dimensions == 3, "Orthtree error: Occlusion culling requires a 3-dimensional tree.");
+        const float width = static_cast<float>(pyramid.Width()), height = static_cast<float>(pyramid.Height());
+        // Returns false if the node is certainly hidden or outside the view
+        auto mayBeVisible = [&](const Node& node) {
+            float minX = width, minY = height, maxX = -1.0f, maxY = -1.0f, minDepth = 1.0f;
+            for (size_t corner = 0; corner < 8; ++corner)
+            {
+                std::array<float, 4> world{ 0.0f, 0.0f, 0.0f, 1.0f }, clip{};
+                for (size_t d = 0; d < 3; ++d)
+                    world[d] = static_cast<float>(node.pos[d] + ((corner >> d & 1) ? node.size[d] : static_cast<T>(0)));
+                for (size_t row = 0; row < 4; ++row)
+                    for (size_t col = 0; col < 4; ++col)
+                        clip[row] += viewProjection[col * 4 + row] * world[col];
+                // Boxes crossing the near plane cannot be projected, so they are kept
+                if (clip[3] <= std::numeric_limits<float>::epsilon())
+                    return true;
+                float x = (clip[0] / clip[3] * 0.5f + 0.5f) * width;
+                float y = (clip[1] / clip[3] * 0.5f + 0.5f) * height;
+                minX = std::min(minX, x);
+                maxX = std::max(maxX, x);
+                minY = std::min(minY, y);
+                maxY = std::max(maxY, y);
+                minDepth = std::min(minDepth, clip[2] / clip[3] * 0.5f + 0.5f);
+            }
+            if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height || minDepth > 1.0f)
+                return false;
+            return !pyramid.IsOccluded(minX, minY, maxX, maxY, std::max(minDepth, 0.0f));
+        };
+
+        // Children in an order in which none can hide one visited before it: the child on the
+        // eye's side of every axis first, then those differing from it in one axis, and so on
+        static constexpr std::array<size_t, 8> order{ 0, 1, 2, 4, 3, 5, 6, 7 };
+        std::vector<size_t> stack;
+        if (!mNodes.empty())
+            stack.push_back(0);
+        while (!stack.empty())
+        {
+            size_t index = stack.back();
+            stack.pop_back();
+            const Node& node = mNodes[index];
+            if (!mayBeVisible(node))
+                continue;
+            if (node.isLeaf)
+            {
+                fn(node, index);
+                continue;
+            }
+            size_t nearest = 0;
+            for (size_t d = 0; d < 3; ++d)
+                if (eye[d] >= node.centre[d])
+                    nearest |= size_t(1) << d;
+            for (size_t i = 8; i-- > 0;)
+            {
+                stack.push_back(node.firstChild + (nearest ^ order[i]));
+                PrefetchNode(stack.back());
+            }
+        }
+    }
+
+    // Maximal Poisson-disk sampling of the box [lowerBounds, upperBounds) with a fixed radius
+    [[nodiscard]] static std::vector<VecN> PoissonDiskSample(const VecN& lowerBounds, const VecN& upperBounds,
+                                                             T radius, uint32_t seed = 0)
+    {
+        return PoissonDiskSample(lowerBounds, upperBounds, [radius](const VecN&) { return radius; },
+                                 radius, radius, seed);
+    }
+
+    // Maximal Poisson-disk sampling with a variable radius, which must stay within
+    // [minRadius, maxRadius]. Every sample s owns the disc of radius(s) around it, and no later
+    // sample may fall inside an earlier sample's disc.
+    // Darts are thrown into the active cells of an implicit orthtree over a background grid of
+    // cells too small to hold two samples. After every round of darts, cells lying entirely
+    // inside a sample's disc are pruned and the remaining ones are subdivided, which fills the
+    // gaps left between discs until the domain is covered.
+    template<typename RadiusFunction>
+    [[nodiscard]] static std::vector<VecN> PoissonDiskSample(const VecN& lowerBounds, const VecN& upperBounds,
+                                                             RadiusFunction&& radius, T minRadius, T maxRadius,
+                                                             uint32_t seed = 0)
+    {
+        static_assert(std::is_floating_point_v<T>, "Orthtree error: Poisson-disk sampling requires floating point T.");
+        if (!(minRadius > 0) || maxRadius < minRadius)
+            throw std::invalid_argument("Orthtree error: Poisson-disk radii must satisfy 0 < minRadius <= maxRadius.");
+
+        // Background grid holding at most one sample per cell
+        const T cellSize = minRadius / std::sqrt(static_cast<T>(dimensions));
+        std::array<size_t, dimensions> gridSize;
+        size_t numCells = 1;
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            gridSize[d] = std::max<size_t>(1, static_cast<size_t>(std::ceil((upperBounds[d] - lowerBounds[d]) / cellSize)));
+            if (numCells > std::numeric_limits<size_t>::max() / gridSize[d])
+                throw std::length_error("Orthtree error: Poisson-disk radius is too small for the domain.");
+            numCells *= gridSize[d];
+        }
+        std::vector<size_t> grid(numCells, npos);
+        std::vector<VecN> samples;
+        std::vector<T> radii;
+
+        auto gridCoord = [&](T value, size_t d) {
+            T cell = std::floor((value - lowerBounds[d]) / cellSize);
+            return cell <= 0 ? size_t(0) : std::min(gridSize[d] - 1, static_cast<size_t>(cell));
+        };
+        auto gridIndex = [&](const VecN& point) {
+            size_t index = 0;
+            for (size_t d = dimensions; d-- > 0;)
+                index = index * gridSize[d] + gridCoord(point[d], d);
+            return index;
+        };
+        // Calls fn(sample) for the samples in grid cells within reach of point until fn returns false
+        auto forEachNearby = [&](const VecN& point, T reach, auto&& fn) {
+            std::array<size_t, dimensions> first, last, cell;
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                first[d] = gridCoord(point[d] - reach, d);
+                last[d]  = gridCoord(point[d] + reach, d);
+            }
+            cell = first;
+            while (true)
+            {
+                size_t index = 0;
+                for (size_t d = dimensions; d-- > 0;)
+                    index = index * gridSize[d] + cell[d];
+                if (grid[index] != npos && !fn(grid[index]))
+                    return false;
+                size_t d = 0;
+                for (; d < dimensions && cell[d] == last[d]; ++d)
+                    cell[d] = first[d];
+                if (d == dimensions)
+                    return true;
+                ++cell[d];
+            }
+        };
+        // The active cells are the uncovered leaves of an implicit orthtree whose roots are the
+        // background grid cells. All cells of a level share one size, so only their lower
+        // corners are stored.
+        std::vector<VecN> active(numCells), next;
+        for (size_t i = 0; i < numCells; ++i)
+            for (size_t d = 0, index = i; d < dimensions; ++d, index /= gridSize[d - 1])
+                active[i][d] = lowerBounds[d] + static_cast<T>(index % gridSize[d]) * cellSize;
+        T size = cellSize;
+
+        // A cell is covered when all of it lies inside the disc of one of the nearby samples
+        auto covered = [&](const VecN& cell, T width, const std::vector<size_t>& nearby) {
+            const VecN centre = cell + width / static_cast<T>(2);
+            if (grid[gridIndex(centre)] != npos)
+                return true;
+            for (size_t sample : nearby)
+            {
+                T farSqr = static_cast<T>(0);
+                for (size_t d = 0; d < dimensions; ++d)
+                {
+                    T diff = std::abs(samples[sample][d] - centre[d]) + width / static_cast<T>(2);
+                    farSqr += diff * diff;
+                }
+                if (farSqr < radii[sample] * radii[sample])
+                    return true;
+            }
+            return false;
+        };
+
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<T> unit(static_cast<T>(0), static_cast<T>(1));
+        std::vector<size_t> nearby;
+        // Cells stop splitting only once halving them no longer moves their corners, that is
+        // when T runs out of precision
+        T magnitude = static_cast<T>(0);
+        for (size_t d = 0; d < dimensions; ++d)
+            magnitude = std::max({ magnitude, std::abs(lowerBounds[d]), std::abs(upperBounds[d]) });
+        for (; !active.empty(); size /= static_cast<T>(2))
+        {
+            // One dart per active cell, each thrown into a random cell of a window of nearby
+            // ones. The cells are stored in spatial order, so this keeps the grid lookups in
+            // cache while preserving the sample density of fully random dart placement.
+            constexpr size_t window = 4096;
+            for (size_t dart = 0; dart < active.size(); ++dart)
+            {
+                const size_t windowBegin = dart - dart % window;
+                std::uniform_int_distribution<size_t> pick(windowBegin, std::min(active.size(), windowBegin + window) - 1);
+                const VecN& cell = active[pick(rng)];
+                VecN candidate;
+                bool inside = true;
+                for (size_t d = 0; d < dimensions; ++d)
+                {
+                    candidate[d] = cell[d] + unit(rng) * size;
+                    inside &= candidate[d] < upperBounds[d];
+                }
+                if (!inside)
+                    continue;
+                size_t index = gridIndex(candidate);
+                if (grid[index] != npos)
+                    continue;
+                bool accepted = forEachNearby(candidate, maxRadius, [&](size_t sample) {
+                    T dSqr = static_cast<T>(0);
+                    for (size_t d = 0; d < dimensions; ++d)
+                        dSqr += (candidate[d] - samples[sample][d]) * (candidate[d] - samples[sample][d]);
+                    return dSqr >= radii[sample] * radii[sample];
+                });
+                if (!accepted)
+                    continue;
+                grid[index] = samples.size();
+                samples.push_back(candidate);
+                radii.push_back(radius(candidate));
+            }
+
+            if (magnitude + size / static_cast<T>(2) == magnitude)
+                break;
+            // Prune covered cells and split the others, keeping their uncovered children that
+            // overlap the domain. The samples which can cover a cell or its children are
+            // gathered once per cell.
+            const T reach = maxRadius + size * std::sqrt(static_cast<T>(dimensions)) / static_cast<T>(2);
+            next.clear();
+            for (const VecN& cell : active)
+            {
+                const VecN centre = cell + size / static_cast<T>(2);
+                nearby.clear();
+                forEachNearby(centre, reach, [&](size_t sample) {
+                    T dSqr = static_cast<T>(0);
+                    for (size_t d = 0; d < dimensions; ++d)
+                        dSqr += (samples[sample][d] - centre[d]) * (samples[sample][d] - centre[d]);
+                    if (dSqr < reach * reach)
+                        nearby.push_back(sample);
+                    return true;
+                });
+                if (covered(cell, size, nearby))
+                    continue;
+                for (size_t i = 0; i < numChildren; ++i)
+                {
+                    VecN child = cell;
+                    bool inside = true;
+                    for (size_t d = 0; d < dimensions; ++d)
+                        if (i >> d & 1)
+                            inside &= (child[d] += size / static_cast<T>(2)) < upperBounds[d];
+                    if (inside && !covered(child, size / static_cast<T>(2), nearby))
+                        next.push_back(child);
+                }
+            }
+            active.swap(next);
+        }
+        return samples;
+    }
+
+    struct Iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type   = std::ptrdiff_t;
+        using value_type        = Node;
+        using pointer           = Node*;
+        using reference         = Node&;
+
+        explicit Iterator(pointer ptr) : mPtr(ptr) {}
+
+        reference operator*() const { return *mPtr; }
+        pointer operator->() { return mPtr; }
+        Iterator& operator++() { mPtr++; return *this; }
+        Iterator operator++(int) { Iterator tmp = *this; ++(*this); return tmp; }
+        friend bool operator== (const Iterator& a, const Iterator& b) { return a.mPtr == b.mPtr; };
+        friend bool operator!= (const Iterator& a, const Iterator& b) { return a.mPtr != b.mPtr; };
+    private:
+        pointer mPtr;
+    };
+
+    Iterator begin() { return Iterator(mNodes.begin().base()); }
+    Iterator end()   { return Iterator(mNodes.end().base()); }
+};
+
+// Unbounded point index made of a hash map of orthtrees, one per tile of a coarse lattice.
+// Tiles are created on demand as points arrive, so no bounds have to be known up front, and
+// queries span all tiles they touch. Points get forest-wide indices in insertion order and
+// are stored only in their tile's tree.
+template<size_t dimensions = 2, typename T = float>
+class OrthtreeForest
+{
+public:
+    using Tree = Orthtree<dimensions, T>;
+    using VecN = typename Tree::VecN;
+    using TileKey = std::array<int64_t, dimensions>;
+    static constexpr size_t npos = Tree::npos;
+
+    // Each tile covers tileSize along every axis and is a point-region tree with the given
+    // maximum depth and bucket capacity
+    OrthtreeForest(VecN tileSize, size_t maxDepth, size_t bucketCapacity) :
+            mTileSize(tileSize), mMaxDepth(maxDepth), mBucketCapacity(bucketCapacity)
+    {
+        static_assert(std::is_floating_point_v<T> || std::is_signed_v<T>,
+                      "Orthtree error: Forest coordinates must be signed.");
+        for (size_t d = 0; d < dimensions; ++d)
+            if (!(tileSize[d] > 0))
+                throw std::invalid_argument("Orthtree error: Forest tile size must be positive.");
+    }
+
+    // Shares a thread pool with every tile, existing and future
+    void SetThreadPool(OrthtreeThreadPool* pool) noexcept
+    {
+        mPool = pool;
+        for (Tile& tile : mTiles)
+            tile.tree.SetThreadPool(pool);
+    }
+
+    // Adds a point, creating its tile if needed, and returns its index
+    size_t Insert(const VecN& point)
+    {
+        TileKey key = KeyOf(point);
+        auto found = mTileIndex.find(key);
+        if (found == mTileIndex.end())
+        {
+            Tile& tile = mTiles.emplace_back();
+            tile.key = key;
+            VecN lower, upper;
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                lower[d] = static_cast<T>(key[d]) * mTileSize[d];
+                upper[d] = lower[d] + mTileSize[d];
+            }
+            tile.tree.SetThreadPool(mPool);
+            tile.tree.Generate(lower, upper, mMaxDepth, std::vector<VecN>(), mBucketCapacity);
+            found = mTileIndex.emplace(key, mTiles.size() - 1).first;
+        }
+        Tile& tile = mTiles[found->second];
+        tile.tree.Insert(point);
+        tile.ids.push_back(mTileOf.size());
+        mTileOf.push_back(found->second);
+        return mTileOf.size() - 1;
+    }
+
+    [[nodiscard]] size_t NumPoints() const noexcept
+    {
+        return mTileOf.size();
+    }
+
+    // Gets a point by index. Points are stored only in their tile; since indices are handed out
+    // in insertion order, the tile's list of indices is sorted and is searched for the point.
+    [[nodiscard]] const VecN& Point(size_t id) const
+    {
+        if (id >= mTileOf.size())
+            throw std::out_of_range("Orthtree error: Point index out of range.");
+        const Tile& tile = mTiles[mTileOf[id]];
+        size_t item = static_cast<size_t>(std::lower_bound(tile.ids.begin(), tile.ids.end(), id) - tile.ids.begin());
+        return tile.tree.Points()[item];
+    }
+
+    [[nodiscard]] size_t NumTiles() const noexcept
+    {
+        return mTiles.size();
+    }
+
+    // Gets the tree of a tile, or nullptr if no point has landed in it
+    [[nodiscard]] const Tree* FindTile(const TileKey& key) const
+    {
+        auto found = mTileIndex.find(key);
+        return found == mTileIndex.end() ? nullptr : &mTiles[found->second].tree;
+    }
+
+    // Gets the tile a point falls into
+    [[nodiscard]] TileKey KeyOf(const VecN& point) const
+    {
+        TileKey key;
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            key[d] = static_cast<int64_t>(std::floor(static_cast<double>(point[d]) / static_cast<double>(mTileSize[d])));
+            // Guard against rounding putting the point just outside the tile's half-open box
+            if (point[d] < static_cast<T>(key[d]) * mTileSize[d])
+                --key[d];
+            else if (point[d] >= static_cast<T>(key[d]) * mTileSize[d] + mTileSize[d])
+                ++key[d];
+        }
+        return key;
+    }
+
+    // Gets the indices of all points within radius of centre
+    [[nodiscard]] std::vector<size_t> PointsInRadius(const VecN& centre, T radius) const
+    {
+        std::vector<size_t> result;
+        VecN lower = centre, upper = centre;
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            lower[d] -= radius;
+            upper[d] += radius;
+        }
+        ForEachTileInBox(lower, upper, [&](const Tile& tile) {
+            for (size_t item : tile.tree.PointsInRadius(centre, radius))
+                result.push_back(tile.ids[item]);
+        });
+        return result;
+    }
+
+    // Gets the indices of all points inside the box [lowerBounds, upperBounds]
+    [[nodiscard]] std::vector<size_t> PointsInRange(const VecN& lowerBounds, const VecN& upperBounds) const
+    {
+        std::vector<size_t> result;
+        ForEachTileInBox(lowerBounds, upperBounds, [&](const Tile& tile) {
+            for (size_t leaf : tile.tree.QueryRange(lowerBounds, upperBounds))
+                for (size_t item : tile.tree[leaf].items)
+                {
+                    const VecN& point = tile.tree.Points()[item];
+                    bool inside = true;
+                    for (size_t d = 0; d < dimensions && inside; ++d)
+                        inside = lowerBounds[d] <= point[d] && point[d] <= upperBounds[d];
+                    if (inside)
+                        result.push_back(tile.ids[item]);
+                }
+        });
+        return result;
+    }
+
+    // Gets the indices of the k points closest to point, nearest first. Tiles are searched in
+    // order of their distance to point until none can hold anything closer.
+    [[nodiscard]] std::vector<size_t> KNearest(const VecN& point, size_t k) const
+    {
+        if (!k)
+            return {};
+        std::vector<std::pair<T, const Tile*>> tiles;
+        for (const Tile& tile : mTiles)
+        {
+            T dSqr = static_cast<T>(0);
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                T lower = static_cast<T>(tile.key[d]) * mTileSize[d], upper = lower + mTileSize[d];
+                T diff = point[d] < lower ? lower - point[d] : point[d] > upper ? point[d] - upper : static_cast<T>(0);
+                dSqr += diff * diff;
+            }
+            tiles.push_back({ dSqr, &tile });
+        }
+        std::sort(tiles.begin(), tiles.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        std::vector<std::pair<T, size_t>> nearest;
+        for (const auto& [tileDistSqr, tile] : tiles)
+        {
+            if (nearest.size() == k && tileDistSqr > nearest.back().first)
+                break;
+            for (size_t item : tile->tree.KNearest(point, k))
+            {
+                const VecN& other = tile->tree.Points()[item];
+                T dSqr = static_cast<T>(0);
+                for (size_t d = 0; d < dimensions; ++d)
+                    dSqr += (other[d] - point[d]) * (other[d] - point[d]);
+                nearest.push_back({ dSqr, tile->ids[item] });
+            }
+            std::sort(nearest.begin(), nearest.end());
+            if (nearest.size() > k)
+                nearest.resize(k);
+        }
+        std::vector<size_t> result;
+        for (const auto& candidate : nearest)
+            result.push_back(candidate.second);
+        return result;
+    }
+
+private:
+    struct Tile
+    {
+        TileKey key;
+        Tree tree;
+        std::vector<size_t> ids;   // forest index of each of the tree's points, ascending
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const TileKey& key) const noexcept
+        {
+            size_t hash = 0;
+            for (int64_t coordinate : key)
+                hash = hash * 1099511628211ull ^ std::hash<int64_t>()(coordinate);
+            return hash;
+        }
+    };
+
+    // Calls fn(tile) for the existing tiles overlapping [lowerBounds, upperBounds], looking them
+    // up by key when the box covers fewer lattice cells than there are tiles
+    template<typename F>
+    void ForEachTileInBox(const VecN& lowerBounds, const VecN& upperBounds, F&& fn) const
+    {
+        TileKey first = KeyOf(lowerBounds), last = KeyOf(upperBounds);
+        double numKeys = 1;
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            if (last[d] < first[d])
+                return;
+            numKeys *= static_cast<double>(last[d] - first[d] + 1);
+        }
+        if (numKeys > static_cast<double>(mTiles.size()))
+        {
+            for (const Tile& tile : mTiles)
+            {
+                bool overlaps = true;
+                for (size_t d = 0; d < dimensions && overlaps; ++d)
+                    overlaps = first[d] <= tile.key[d] && tile.key[d] <= last[d];
+                if (overlaps)
+                    fn(tile);
+            }
+            return;
+        }
+        TileKey key = first;
+        while (true)
+        {
+            auto found = mTileIndex.find(key);
+            if (found != mTileIndex.end())
+                fn(mTiles[found->second]);
+            size_t d = 0;
+            for (; d < dimensions && key[d] == last[d]; ++d)
+                key[d] = first[d];
+            if (d == dimensions)
+                return;
+            ++key[d];
+        }
+    }
+
+    VecN mTileSize;
+    size_t mMaxDepth, mBucketCapacity;
+    OrthtreeThreadPool* mPool = nullptr;
+    std::deque<Tile> mTiles;   // a deque, so that trees handed out by FindTile stay put
+    std::unordered_map<TileKey, size_t, KeyHash> mTileIndex;
+    std::vector<size_t> mTileOf;   // tile of each point
+};
+
+// Point-region tree read page by page from a file written by Orthtree::WritePages, for trees
+// too large to load whole. Pages are read on first touch and kept in a least recently used
+// cache of about memoryBudget bytes. Queries hold on to the page they are working in, so the
+// cache can briefly exceed the budget. With a thread pool set, traversals prefetch the pages
+// they are about to enter in the background. Queries may run concurrently.
+template<size_t dimensions = 2, typename T = float>
+class PagedOrthtree
+{
+public:
+    using VecN = typename Orthtree<dimensions, T>::VecN;
+    static constexpr size_t npos = Orthtree<dimensions, T>::npos;
+
+    // Reads the directory of a paged tree starting at the stream's position and ending at
+    // the end of the stream. The stream must support seeking and outlive the tree.
+    PagedOrthtree(std::istream& in, size_t memoryBudget) : mIn(in), mMemoryBudget(memoryBudget)
+    {
+        mBase = mIn.tellg();
+        char magic[4];
+        if (!mIn.read(magic, 4) || std::string(magic, 4) != "ORTP" || ReadValue<uint32_t>() != 1)
+            throw std::runtime_error("Orthtree error: Not a paged tree.");
+        if (ReadValue<uint32_t>() != dimensions || ReadValue<uint32_t>() != sizeof(T))
+            throw std::runtime_error("Orthtree error: Paged tree has different dimensions or coordinate type.");
+        mNumPoints = static_cast<size_t>(ReadValue<uint64_t>());
+        mIn.seekg(-static_cast<std::streamoff>(sizeof(uint64_t)), std::ios::end);
+        mIn.seekg(mBase + static_cast<std::streamoff>(ReadValue<uint64_t>()));
+        mPages.resize(static_cast<size_t>(ReadValue<uint64_t>()));
+        for (PageInfo& page : mPages)
+        {
+            page.offset = ReadValue<uint64_t>();
+            page.bytes = ReadValue<uint64_t>();
+            page.numNodes = ReadValue<uint64_t>();
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                page.pos[d] = ReadValue<T>();
+                page.size[d] = ReadValue<T>();
+            }
+        }
+        mLoading.assign(mPages.size(), false);
+    }
+
+    PagedOrthtree(const PagedOrthtree&) = delete;
+    PagedOrthtree& operator=(const PagedOrthtree&) = delete;
+
+    ~PagedOrthtree()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mChanged.wait(lock, [&] { return mPending == 0; });
+    }
+
+    // Prefetching needs a pool, which must outlive the tree
+    void SetThreadPool(OrthtreeThreadPool* pool) noexcept
+    {
+        mPool = pool;
+    }
+
+    void SetMemoryBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mMemoryBudget = bytes;
+        Evict();
+    }
+
+    [[nodiscard]] size_t NumPages() const noexcept
+    {
+        return mPages.size();
+    }
+
+    [[nodiscard]] size_t NumPoints() const noexcept
+    {
+        return mNumPoints;
+    }
+
+    // Bytes taken by the pages in the cache
+    [[nodiscard]] size_t CachedBytes() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mCachedBytes;
+    }
+
+    // Number of pages read from the stream so far
+    [[nodiscard]] size_t PageLoads() const noexcept
+    {
+        return mPageLoads.load();
+    }
+
+    // Hints that the box [lowerBounds, upperBounds] will be queried soon. Pages overlapping
+    // it are loaded coarse to fine, as many as fit the budget, on the pool if one is set.
+    void Prefetch(const VecN& lowerBounds, const VecN& upperBounds) const
+    {
+        size_t bytes = 0;
+        for (size_t page = 0; page < mPages.size() && bytes < mMemoryBudget; ++page)
+        {
+            const PageInfo& info = mPages[page];
+            bool overlaps = true;
+            for (size_t d = 0; d < dimensions && overlaps; ++d)
+                overlaps = lowerBounds[d] <= info.pos[d] + info.size[d] && info.pos[d] <= upperBounds[d];
+            if (!overlaps)
+                continue;
+            bytes += static_cast<size_t>(info.bytes);
+            if (mPool)
+                PrefetchPage(page);
+            else
+                GetPage(page);
+        }
+    }
+
+    // Gets the indices of all points inside the box [lowerBounds, upperBounds]
+    [[nodiscard]] std::vector<size_t> PointsInRange(const VecN& lowerBounds, const VecN& upperBounds) const
+    {
+        std::vector<size_t> result;
+        ForEachLeaf([&](const Node& node) {
+            for (size_t d = 0; d < dimensions; ++d)
+                if (upperBounds[d] < node.pos[d] || lowerBounds[d] > node.pos[d] + node.size[d])
+                    return false;
+            return true;
+        }, [&](const Page& page, const Node& leaf) {
+            for (size_t i = leaf.itemBegin; i < leaf.itemEnd; ++i)
+            {
+                bool inside = true;
+                for (size_t d = 0; d < dimensions && inside; ++d)
+                    inside = lowerBounds[d] <= page.points[i][d] && page.points[i][d] <= upperBounds[d];
+                if (inside)
+                    result.push_back(page.items[i]);
+            }
+        });
+        return result;
+    }
+
+    // Gets the indices of all points within radius of centre
+    [[nodiscard]] std::vector<size_t> PointsInRadius(const VecN& centre, T radius) const
+    {
+        std::vector<size_t> result;
+        const T radiusSqr = radius * radius;
+        ForEachLeaf([&](const Node& node) {
+            return BoxDistanceSqr(node, centre) <= radiusSqr;
+        }, [&](const Page& page, const Node& leaf) {
+            for (size_t i = leaf.itemBegin; i < leaf.itemEnd; ++i)
+                if (DistanceSqr(page.points[i], centre) <= radiusSqr)
+                    result.push_back(page.items[i]);
+        });
+        return result;
+    }
+
+    // Gets the indices of the k points closest to point, nearest first
+    [[nodiscard]] std::vector<size_t> KNearest(const VecN& point, size_t k) const
+    {
+        struct Candidate
+        {
+            T distSqr;
+            size_t page, node;
+            bool operator<(const Candidate& other) const { return distSqr > other.distSqr; }
+        };
+        std::vector<std::pair<T, size_t>> nearest;      // max-heap of found points
+        std::vector<Candidate> queue;                   // min-heap of nodes
+        // Only the page of the node being expanded is held, others go back through the cache
+        std::shared_ptr<const Page> page;
+        size_t pageIndex = npos;
+        if (mPages.empty() || !k)
+            return {};
+        queue.push_back({ static_cast<T>(0), 0, 0 });
+        while (!queue.empty())
+        {
+            std::pop_heap(queue.begin(), queue.end());
+            Candidate candidate = queue.back();
+            queue.pop_back();
+            if (nearest.size() == k && candidate.distSqr > nearest.front().first)
+                break;
+            if (candidate.page != pageIndex)
+            {
+                page.reset();
+                page = GetPage(candidate.page);
+                pageIndex = candidate.page;
+            }
+            const Node& node = page->nodes[candidate.node];
+            if (node.childPage != npos)
+            {
+                queue.push_back({ candidate.distSqr, node.childPage, 0 });
+                std::push_heap(queue.begin(), queue.end());
+                PrefetchPage(node.childPage);
+                continue;
+            }
+            if (node.firstChild == npos)
+            {
+                for (size_t i = node.itemBegin; i < node.itemEnd; ++i)
+                {
+                    T distSqr = DistanceSqr(page->points[i], point);
+                    if (nearest.size() < k)
+                        nearest.push_back({ distSqr, page->items[i] });
+                    else if (distSqr < nearest.front().first)
+                    {
+                        std::pop_heap(nearest.begin(), nearest.end());
+                        nearest.back() = { distSqr, page->items[i] };
+                    }
+                    else
+                        continue;
+                    std::push_heap(nearest.begin(), nearest.end());
+                }
+                continue;
+            }
+            for (size_t i = 0; i < numChildren; ++i)
+            {
+                T childDistSqr = BoxDistanceSqr(page->nodes[node.firstChild + i], point);
+                if (nearest.size() == k && childDistSqr > nearest.front().first)
+                    continue;
+                queue.push_back({ childDistSqr, candidate.page, node.firstChild + i });
+                std::push_heap(queue.begin(), queue.end());
+            }
+        }
+        std::sort_heap(nearest.begin(), nearest.end());
+        std::vector<size_t> result;
+        result.reserve(nearest.size());
+        for (auto& found : nearest)
+            result.push_back(found.second);
+        return result;
+    }
+
+private:
+    static constexpr size_t numChildren = size_t(1) << dimensions;
+
+    struct PageInfo
+    {
+        uint64_t offset, bytes, numNodes;
+        VecN pos, size;
+    };
+
+    // firstChild is npos for leaves and for nodes whose children are in childPage
+    struct Node
+    {
+        VecN pos, size;
+        size_t firstChild, childPage, itemBegin, itemEnd;
+    };
+
+    struct Page
+    {
+        std::vector<Node> nodes;
+        std::vector<size_t> items;
+        std::vector<VecN> points;
+    };
+
+    struct CacheEntry
+    {
+        std::shared_ptr<const Page> page;
+        size_t bytes;
+        typename std::list<size_t>::iterator lru;
+    };
+
+    template<typename V>
+    V ReadValue()
+    {
+        V value;
+        if (!mIn.read(reinterpret_cast<char*>(&value), sizeof(V)))
+            throw std::runtime_error("Orthtree error: Unexpected end of paged tree.");
+        return value;
+    }
+
+    static T DistanceSqr(const VecN& a, const VecN& b) noexcept
+    {
+        T dSqr = static_cast<T>(0);
+        for (size_t d = 0; d < dimensions; ++d)
+            dSqr += (a[d] - b[d]) * (a[d] - b[d]);
+        return dSqr;
+    }
+
+    static T BoxDistanceSqr(const Node& node, const VecN& point) noexcept
+    {
+        T dSqr = static_cast<T>(0);
+        for (size_t d = 0; d < dimensions; ++d)
+        {
+            T diff = std::max({ static_cast<T>(0), node.pos[d] - point[d], point[d] - (node.pos[d] + node.size[d]) });
+            dSqr += diff * diff;
+        }
+        return dSqr;
+    }
+
+    // Walks the pages depth first, calling fn(page, leaf) for every leaf whose node satisfies
+    // overlaps. Pages are visited one at a time and the pages below are prefetched as found.
+    template<typename Overlaps, typename F>
+    void ForEachLeaf(Overlaps&& overlaps, F&& fn) const
+    {
+        std::vector<size_t> pages, stack;
+        if (!mPages.empty())
+            pages.push_back(0);
+        while (!pages.empty())
+        {
+            const std::shared_ptr<const Page> page = GetPage(pages.back());
+            pages.pop_back();
+            stack.assign(1, 0);
+            while (!stack.empty())
+            {
+                const Node& node = page->nodes[stack.back()];
+                stack.pop_back();
+                if (!overlaps(node))
+                    continue;
+                if (node.childPage != npos)
+                {
+                    pages.push_back(node.childPage);
+                    PrefetchPage(node.childPage);
+                }
+                else if (node.firstChild == npos)
+                    fn(*page, node);
+                else
+                    for (size_t i = numChildren; i-- > 0;)
+                        stack.push_back(node.firstChild + i);
+            }
+        }
+    }
+
+    // Reads and decodes a page. Only the read itself holds the stream.
+    std::shared_ptr<const Page> ReadPage(size_t index) const
+    {
+        const PageInfo& info = mPages[index];
+        std::vector<char> bytes(static_cast<size_t>(info.bytes));
+        {
+            std::lock_guard<std::mutex> lock(mStreamMutex);
+            mIn.clear();
+            mIn.seekg(mBase + static_cast<std::streamoff>(info.offset));
+            if (!mIn.read(bytes.data(), static_cast<std::streamsize>(bytes.size())))
+                throw std::runtime_error("Orthtree error: Unexpected end of paged tree.");
+        }
+        size_t cursor = 0;
+        auto read = [&](auto& value) {
+            if (cursor + sizeof(value) > bytes.size())
+                throw std::runtime_error("Orthtree error: Paged tree is corrupt.");
+            std::memcpy(&value, bytes.data() + cursor, sizeof(value));
+            cursor += sizeof(value);
+        };
+        auto page = std::make_shared<Page>();
+        page->nodes.resize(static_cast<size_t>(info.numNodes));
+        for (Node& node : page->nodes)
+        {
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                read(node.pos[d]);
+                read(node.size[d]);
+            }
+            uint64_t level, firstChild, childPage, numItems;
+            read(level);            // kept in the file for other readers
+            read(firstChild);
+            read(childPage);
+            read(numItems);
+            if ((firstChild != npos && firstChild + numChildren > info.numNodes) ||
+                (childPage != npos && childPage >= mPages.size()))
+                throw std::runtime_error("Orthtree error: Paged tree is corrupt.");
+            node.firstChild = static_cast<size_t>(firstChild);
+            node.childPage = static_cast<size_t>(childPage);
+            node.itemBegin = page->items.size();
+            for (uint64_t i = 0; i < numItems; ++i)
+            {
+                uint64_t item;
+                VecN point;
+                read(item);
+                for (size_t d = 0; d < dimensions; ++d)
+                    read(point[d]);
+                page->items.push_back(static_cast<size_t>(item));
+                page->points.push_back(point);
+            }
+            node.itemEnd = page->items.size();
+        }
+        ++mPageLoads;
+        return page;
+    }
+
+    // Gets a page from the cache, reading it if needed. A page being read by another thread
+    // is waited for rather than read twice.
+    std::shared_ptr<const Page> GetPage(size_t index) const
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true)
+        {
+            auto found = mCache.find(index);
+            if (found != mCache.end())
+            {
+                mLru.splice(mLru.begin(), mLru, found->second.lru);
+                return found->second.page;
+            }
+            if (!mLoading[index])
+                break;
+            mChanged.wait(lock);
+        }
+        mLoading[index] = true;
+        lock.unlock();
+        std::shared_ptr<const Page> page;
+        try
+        {
+            page = ReadPage(index);
+        }
+        catch (...)
+        {
+            lock.lock();
+            mLoading[index] = false;
+            mChanged.notify_all();
+            throw;
+        }
+        lock.lock();
+        mLoading[index] = false;
+        mLru.push_front(index);
+        const size_t bytes = sizeof(Page) + page->nodes.size() * sizeof(Node) +
+                             page->items.size() * (sizeof(size_t) + sizeof(VecN));
+        mCache.emplace(index, CacheEntry{ page, bytes, mLru.begin() });
+        mCachedBytes += bytes;
+        Evict();
+        mChanged.notify_all();
+        return page;
+    }
+
+    // Reads a page on the pool unless it is cached or already being read
+    void PrefetchPage(size_t index) const
+    {
+        if (!mPool)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mLoading[index] || mCache.count(index))
+                return;
+            ++mPending;
+        }
+        mPool->Submit([this, index] {
+            try
+            {
+                GetPage(index);
+            }
+            catch (...)
+            {
+                // A failed prefetch is retried, and reported, by the query that needs the page
+            }
+            std::lock_guard<std::mutex> lock(mMutex);
+            --mPending;
+            mChanged.notify_all();
+        }, OrthtreeThreadPool::Priority::Low);
+    }
+
+    // Drops least recently used pages until the cache fits the budget, keeping the newest.
+    // Expects mMutex to be held.
+    void Evict() const
+    {
+        while (mCachedBytes > mMemoryBudget && mLru.size() > 1)
+        {
+            auto found = mCache.find(mLru.back());
+            mCachedBytes -= found->second.bytes;
+            mCache.erase(found);
+            mLru.pop_back();
+        }
+    }
+
+    std::istream& mIn;
+    std::streampos mBase;
+    size_t mMemoryBudget, mNumPoints = 0;
+    std::vector<PageInfo> mPages;
+    OrthtreeThreadPool* mPool = nullptr;
+
+    mutable std::mutex mMutex, mStreamMutex;
+    mutable std::condition_variable mChanged;
+    mutable std::unordered_map<size_t, CacheEntry> mCache;
+    mutable std::list<size_t> mLru;                  // most recently used first
+    mutable std::vector<bool> mLoading;
+    mutable size_t mCachedBytes = 0, mPending = 0;
+    mutable std::atomic<size_t> mPageLoads{ 0 };
+};
+
+// Point-region tree whose number of dimensions is only known at run time. Dimensions up to
+// maxStaticDimensions are served by the matching Orthtree instantiation. Beyond that a node
+// would have too many children, so a tree with a runtime stride takes over which halves one
+// axis per level, kd style, always the widest side of the node's box. Points are passed
+// row-major, Dimensions() values per point, and are read in place rather than copied.
+template<typename T = float>
+class DynamicOrthtree
+{
+public:
+    static constexpr size_t maxStaticDimensions = 8;
+    static constexpr size_t npos = ~size_t(0);
+
+    explicit DynamicOrthtree(size_t dimensions) : mDimensions(dimensions)
+    {
+        if (dimensions == 0)
+            throw std::invalid_argument("Orthtree error: A tree needs at least one dimension.");
+        if (dimensions <= maxStaticDimensions)
+            Emplace(std::make_index_sequence<maxStaticDimensions>());
+        else
+            std::get<StrideTree>(mTree).dimensions = dimensions;
+    }
+
+    [[nodiscard]] size_t Dimensions() const noexcept
+    {
+        return mDimensions;
+    }
+
+    void SetThreadPool(OrthtreeThreadPool* pool) noexcept
+    {
+        Visit([&](auto& tree) { tree.SetThreadPool(pool); }, [](auto&) {});
+    }
+
+    // Builds the tree over count points of Dimensions() values each, with lowerBounds.size()
+    // == Dimensions(). The points are viewed, not copied, so they must outlive the tree and
+    // stay unchanged. See Orthtree::Generate.
+    void Generate(const std::vector<T>& lowerBounds, const std::vector<T>& upperBounds, size_t maxDepth,
+                  const T* points, size_t count, size_t bucketCapacity)
+    {
+        if (lowerBounds.size() != mDimensions || upperBounds.size() != mDimensions)
+            throw std::invalid_argument("Orthtree error: Bounds do not match the tree's dimensions.");
+        if (!points && count)
+            throw std::invalid_argument("Orthtree error: No buffer given for the points.");
+        Visit([&](auto& tree) {
+            using Tree = std::decay_t<decltype(tree)>;
+            tree.Generate(ToVec<Tree>(lowerBounds.data()), ToVec<Tree>(upperBounds.data()), maxDepth,
+                          Tree::PointView::AoS(points, count, mDimensions), bucketCapacity);
+        }, [&](StrideTree& tree) {
+            tree.Build(lowerBounds, upperBounds, maxDepth * mDimensions, points, count, bucketCapacity);
+        });
+    }
+
+    // Builds the tree over a vector of points, whose size must be a multiple of Dimensions()
+    void Generate(const std::vector<T>& lowerBounds, const std::vector<T>& upperBounds, size_t maxDepth,
+                  const std::vector<T>& points, size_t bucketCapacity)
+    {
+        if (points.size() % mDimensions)
+            throw std::invalid_argument("Orthtree error: Bounds or points do not match the tree's dimensions.");
+        Generate(lowerBounds, upperBounds, maxDepth, points.data(), points.size() / mDimensions, bucketCapacity);
+    }
+
+    // The tree would view a temporary which is gone by the time it is queried
+    void Generate(const std::vector<T>& lowerBounds, const std::vector<T>& upperBounds, size_t maxDepth,
+                  std::vector<T>&& points, size_t bucketCapacity) = delete;
+
+    [[nodiscard]] size_t NumPoints() const
+    {
+        return Visit([](const auto& tree) { return tree.NumPoints(); },
+                     [](const StrideTree& tree) { return tree.count; });
+    }
+
+    // Gets the indices of the k points closest to point, nearest first
+    [[nodiscard]] std::vector<size_t> KNearest(const T* point, size_t k) const
+    {
+        return Visit([&](const auto& tree) {
+            return tree.KNearest(ToVec<std::decay_t<decltype(tree)>>(point), k);
+        }, [&](const StrideTree& tree) {
+            return tree.KNearest(point, k);
+        });
+    }
+
+    // Gets the indices of all points within radius of centre
+    [[nodiscard]] std::vector<size_t> PointsInRadius(const T* centre, T radius) const
+    {
+        return Visit([&](const auto& tree) {
+            return tree.PointsInRadius(ToVec<std::decay_t<decltype(tree)>>(centre), radius);
+        }, [&](const StrideTree& tree) {
+            return tree.PointsInRadius(centre, radius);
+        });
+    }
+
+    // Gets the tree for a dimension count up to maxStaticDimensions, or nullptr if the tree
+    // has a different number of dimensions
+    template<size_t dimensions>
+    [[nodiscard]] Orthtree<dimensions, T>* Get() noexcept
+    {
+        return std::get_if<Orthtree<dimensions, T>>(&mTree);
+    }
+
+private:
+    // Point-region tree over points with a runtime number of dimensions. Each node halves its
+    // box along the widest axis, so the fanout stays 2 however many dimensions there are.
+    // Leaves own a range of order, which lists the indices of the points inside the box.
+    struct StrideTree
+    {
+        struct Node
+        {
+            size_t begin, end;                  // range of order
+            size_t firstChild = npos;           // the two children are adjacent, npos for a leaf
+        };
+
+        size_t dimensions = 0, count = 0;
+        const T* points = nullptr;
+        std::vector<Node> nodes;
+        std::vector<T> bounds;                  // lower then upper corner of each node's box
+        std::vector<size_t> order;
+
+        const T* Point(size_t item) const noexcept
+        {
+            return points + item * dimensions;
+        }
+
+        const T* Lower(size_t node) const noexcept
+        {
+            return bounds.data() + node * 2 * dimensions;
+        }
+
+        const T* Upper(size_t node) const noexcept
+        {
+            return Lower(node) + dimensions;
+        }
+
+        T DistanceSqr(const T* a, const T* b) const noexcept
+        {
+            T dSqr = static_cast<T>(0);
+            for (size_t d = 0; d < dimensions; ++d)
+                dSqr += (a[d] - b[d]) * (a[d] - b[d]);
+            return dSqr;
+        }
+
+        T BoxDistanceSqr(size_t node, const T* point) const noexcept
+        {
+            const T* lower = Lower(node);
+            const T* upper = Upper(node);
+            T dSqr = static_cast<T>(0);
+            for (size_t d = 0; d < dimensions; ++d)
+            {
+                T diff = std::max({ static_cast<T>(0), lower[d] - point[d], point[d] - upper[d] });
+                dSqr += diff * diff;
+            }
+            return dSqr;
+        }
+
+        // Points outside [lower, upper) are not stored, as in Orthtree
+        void Build(const std::vector<T>& lower, const std::vector<T>& upper, size_t maxSplits,
+                   const T* data, size_t numPoints, size_t bucketCapacity)
+        {
+            points = data;
+            count = numPoints;
+            order.clear();
+            for (size_t item = 0; item < count; ++item)
+            {
+                bool inside = true;
+                for (size_t d = 0; d < dimensions && inside; ++d)
+                    inside = Point(item)[d] >= lower[d] && Point(item)[d] < upper[d];
+                if (inside)
+                    order.push_back(item);
+            }
+            nodes.assign(1, Node{ 0, order.size() });
+            bounds = lower;
+            bounds.insert(bounds.end(), upper.begin(), upper.end());
+            std::vector<std::pair<size_t, size_t>> stack{ { 0, 0 } };   // node and depth
+            while (!stack.empty())
+            {
+                auto [index, depth] = stack.back();
+                stack.pop_back();
+                if (nodes[index].end - nodes[index].begin <= bucketCapacity || depth >= maxSplits)
+                    continue;
+                size_t axis = 0;
+                for (size_t d = 1; d < dimensions; ++d)
+                    if (Upper(index)[d] - Lower(index)[d] > Upper(index)[axis] - Lower(index)[axis])
+                        axis = d;
+                const T split = Lower(index)[axis] + (Upper(index)[axis] - Lower(index)[axis]) / static_cast<T>(2);
+                auto middle = std::partition(order.begin() + static_cast<std::ptrdiff_t>(nodes[index].begin),
+                                             order.begin() + static_cast<std::ptrdiff_t>(nodes[index].end),
+                                             [&](size_t item) { return Point(item)[axis] < split; });
+                const size_t mid = static_cast<size_t>(middle - order.begin());
+                const size_t child = nodes.size();
+                nodes[index].firstChild = child;
+                nodes.push_back(Node{ nodes[index].begin, mid });
+                nodes.push_back(Node{ mid, nodes[index].end });
+                const std::vector<T> box(Lower(index), Lower(index) + 2 * dimensions);
+                bounds.insert(bounds.end(), box.begin(), box.end());
+                bounds.insert(bounds.end(), box.begin(), box.end());
+                bounds[(child * 2 + 1) * dimensions + axis] = split;        // upper of the first
+                bounds[(child + 1) * 2 * dimensions + axis] = split;        // lower of the second
+                stack.push_back({ child, depth + 1 });
+                stack.push_back({ child + 1, depth + 1 });
+            }
+        }
+
+        std::vector<size_t> PointsInRadius(const T* centre, T radius) const
+        {
+            std::vector<size_t> result, stack;
+            if (!nodes.empty())
+                stack.push_back(0);
+            while (!stack.empty())
+            {
+                const size_t index = stack.back();
+                stack.pop_back();
+                if (BoxDistanceSqr(index, centre) > radius * radius)
+                    continue;
+                const Node& node = nodes[index];
+                if (node.firstChild != npos)
+                {
+                    stack.push_back(node.firstChild + 1);
+                    stack.push_back(node.firstChild);
+                    continue;
+                }
+                for (size_t i = node.begin; i < node.end; ++i)
+                    if (DistanceSqr(centre, Point(order[i])) <= radius * radius)
+                        result.push_back(order[i]);
+            }
+            return result;
+        }
+
+        std::vector<size_t> KNearest(const T* point, size_t k) const
+        {
+            using Candidate = std::pair<T, size_t>;
+            std::vector<Candidate> nearest, queue;     // max-heap of found points, min-heap of nodes
+            auto closer = [](const Candidate& a, const Candidate& b) { return a.first > b.first; };
+            if (nodes.empty() || !k)
+                return {};
+            queue.push_back({ BoxDistanceSqr(0, point), 0 });
+            while (!queue.empty())
+            {
+                std::pop_heap(queue.begin(), queue.end(), closer);
+                auto [boxDistSqr, index] = queue.back();
+                queue.pop_back();
+                if (nearest.size() == k && boxDistSqr > nearest.front().first)
+                    break;
+                const Node& node = nodes[index];
+                if (node.firstChild == npos)
+                {
+                    for (size_t i = node.begin; i < node.end; ++i)
+                    {
+                        T distSqr = DistanceSqr(point, Point(order[i]));
+                        if (nearest.size() < k)
+                            nearest.push_back({ distSqr, order[i] });
+                        else if (distSqr < nearest.front().first)
+                        {
+                            std::pop_heap(nearest.begin(), nearest.end());
+                            nearest.back() = { distSqr, order[i] };
+                        }
+                        else
+                            continue;
+                        std::push_heap(nearest.begin(), nearest.end());
+                    }
+                    continue;
+                }
+                for (size_t child = node.firstChild; child < node.firstChild + 2; ++child)
+                {
+                    T childDistSqr = BoxDistanceSqr(child, point);
+                    if (nearest.size() == k && childDistSqr > nearest.front().first)
+                        continue;
+                    queue.push_back({ childDistSqr, child });
+                    std::push_heap(queue.begin(), queue.end(), closer);
+                }
+            }
+            std::sort_heap(nearest.begin(), nearest.end());
+            std::vector<size_t> result;
+            result.reserve(nearest.size());
+            for (auto& candidate : nearest)
+                result.push_back(candidate.second);
+            return result;
+        }
+    };
+
+    template<typename Sequence> struct TreeVariant;
+    template<size_t... N>
+    struct TreeVariant<std::index_sequence<N...>>
+    {
+        using type = std::variant<StrideTree, Orthtree<N + 1, T>...>;
+    };
+
+    template<size_t... N>
+    void Emplace(std::index_sequence<N...>)
+    {
+        ((mDimensions == N + 1 ? (void)mTree.template emplace<Orthtree<N + 1, T>>() : (void)0), ...);
+    }
+
+    template<typename Tree> struct TreeDimensions;
+    template<size_t dimensions>
+    struct TreeDimensions<Orthtree<dimensions, T>> : std::integral_constant<size_t, dimensions> {};
+
+    template<typename Tree>
+    [[nodiscard]] static typename Tree::VecN ToVec(const T* data)
+    {
+        typename Tree::VecN vec;
+        for (size_t d = 0; d < TreeDimensions<Tree>::value; ++d)
+            vec[d] = data[d];
+        return vec;
+    }
+
+    // Calls onTree with the Orthtree instantiation in use, or onFlat for the stride tree
+    template<typename OnTree, typename OnFlat>
+    decltype(auto) Visit(OnTree&& onTree, OnFlat&& onFlat)
+    {
+        return std::visit([&](auto& alternative) -> decltype(auto) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(alternative)>, StrideTree>)
+                return onFlat(alternative);
+            else
+                return onTree(alternative);
+        }, mTree);
+    }
+
+    template<typename OnTree, typename OnFlat>
+    decltype(auto) Visit(OnTree&& onTree, OnFlat&& onFlat) const
+    {
+        return std::visit([&](const auto& alternative) -> decltype(auto) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(alternative)>, StrideTree>)
+                return onFlat(alternative);
+            else
+                return onTree(alternative);
+        }, mTree);
+    }
+
+    size_t mDimensions;
+    typename TreeVariant<std::make_index_sequence<maxStaticDimensions>>::type mTree;
+};
+
+// Sparse volume over integer coordinates with a wide, shallow hierarchy in the style of
+// OpenVDB. Top-level nodes are found through a hash map; below them, level l splits every
+// axis 2^log2Branching[l] ways, and the last level is made of leaf bricks of values. Child
+// occupancy and active values are bitmasks, so empty space costs one bit and a lookup is
+// one hash probe plus one step per level, e.g. OrthtreeVolume<float, 3, 5, 4, 3> has
+// 32^3, 16^3 and 8^3 fanouts.
+template<typename ValueT, size_t dimensions, size_t... log2Branching>
+class OrthtreeVolume
+{
+public:
+    using Coord = std::array<int32_t, dimensions>;
+    static constexpr size_t numLevels = sizeof...(log2Branching);
+    static constexpr std::array<size_t, numLevels> log2Dims{ log2Branching... };
+
+    explicit OrthtreeVolume(ValueT background = ValueT()) : mBackground(background)
+    {
+        static_assert(numLevels > 0, "Orthtree error: A volume needs at least one level.");
+        static_assert(((log2Branching * dimensions <= 30) && ...), "Orthtree error: Too many children per node.");
+        static_assert(childLog2[0] + log2Dims[0] < 31, "Orthtree error: Top-level nodes are too large.");
+    }
+
+    // Sets the value at coord and marks it active
+    void SetValue(const Coord& coord, const ValueT& value)
+    {
+        auto [found, inserted] = mRoot.try_emplace(RootKey(coord), 0u);
+        if (inserted)
+            found->second = NewNode(0);
+        uint32_t index = found->second;
+        for (size_t level = 0; level + 1 < numLevels; ++level)
+        {
+            const size_t offset = Offset(coord, level);
+            if (!TestBit(mInternal[level][index].mask, offset))
+            {
+                uint32_t child = NewNode(level + 1);
+                Internal& node = mInternal[level][index];
+                node.mask[offset >> 6] |= uint64_t(1) << (offset & 63);
+                node.children[offset] = child;
+            }
+            index = mInternal[level][index].children[offset];
+        }
+        Leaf& leaf = mLeaves[index];
+        const size_t offset = Offset(coord, numLevels - 1);
+        mActiveCount += !TestBit(leaf.mask, offset);
+        leaf.mask[offset >> 6] |= uint64_t(1) << (offset & 63);
+        leaf.values[offset] = value;
+    }
+
+    // Turns the value at coord off, resetting it to the background. Nodes are kept.
+    void Deactivate(const Coord& coord)
+    {
+        Leaf* found = FindLeaf(coord);
+        if (!found)
+            return;
+        Leaf& leaf = *found;
+        const size_t offset = Offset(coord, numLevels - 1);
+        mActiveCount -= TestBit(leaf.mask, offset);
+        leaf.mask[offset >> 6] &= ~(uint64_t(1) << (offset & 63));
+        leaf.values[offset] = mBackground;
+    }
+
+    // Gets the value at coord, or the background if it is not active
+    [[nodiscard]] ValueT GetValue(const Coord& coord) const
+    {
+        const Leaf* leaf = FindLeaf(coord);
+        return leaf ? leaf->values[Offset(coord, numLevels - 1)] : mBackground;
+    }
+
+    [[nodiscard]] bool IsActive(const Coord& coord) const
+    {
+        const Leaf* leaf = FindLeaf(coord);
+        return leaf && TestBit(leaf->mask, Offset(coord, numLevels - 1));
+    }
+
+    [[nodiscard]] const ValueT& Background() const noexcept
+    {
+        return mBackground;
+    }
+
+    [[nodiscard]] size_t ActiveCount() const noexcept
+    {
+        return mActiveCount;
+    }
+
+    [[nodiscard]] size_t LeafCount() const noexcept
+    {
+        return mLeaves.size();
+    }
+
+    // Calls fn(coord, value) for every active value, walking only set bits of the masks
+    template<typename F>
+    void ForEachActive(F&& fn) const
+    {
+        ForEachLeaf([&](const Coord& origin, const ValueT* values, const uint64_t* mask) {
+            for (size_t word = 0; word < leafMaskWords; ++word)
+                for (uint64_t bits = mask[word]; bits; bits &= bits - 1)
+                {
+                    const size_t offset = word * 64 + OrthtreeLowestBit(bits);
+                    fn(Local(origin, offset, numLevels - 1), values[offset]);
+                }
+        });
+    }
+
+    // Calls fn(origin, values, mask) for every leaf brick. values holds brickSize values with
+    // axis 0 varying fastest, and bit i of mask marks values[i] as active.
+    template<typename F>
+    void ForEachLeaf(F&& fn) const
+    {
+        for (const auto& [key, index] : mRoot)
+        {
+            Coord origin;
+            for (size_t d = 0; d < dimensions; ++d)
+                origin[d] = static_cast<int32_t>(static_cast<uint32_t>(key[d]) << spanLog2(0));
+            Visit(0, index, origin, fn);
+        }
+    }
+
+    // Number of values in a leaf brick
+    static constexpr size_t brickSize = size_t(1) << (log2Dims[numLevels - 1] * dimensions);
+
+private:
+    static constexpr std::array<size_t, numLevels> ComputeChildLog2()
+    {
+        std::array<size_t, numLevels> result{};
+        for (size_t level = numLevels - 1; level-- > 0;)
+            result[level] = result[level + 1] + log2Dims[level + 1];
+        return result;
+    }
+    // log2 of the extent of one child of a node at each level, 0 for leaf values
+    static constexpr std::array<size_t, numLevels> childLog2 = ComputeChildLog2();
+    static constexpr size_t leafMaskWords = (brickSize + 63) / 64;
+
+    static constexpr size_t spanLog2(size_t level)
+    {
+        return childLog2[level] + log2Dims[level];
+    }
+
+    struct Internal
+    {
+        std::vector<uint64_t> mask;
+        std::vector<uint32_t> children;
+    };
+
+    struct Leaf
+    {
+        std::array<uint64_t, leafMaskWords> mask{};
+        std::array<ValueT, brickSize> values;
+    };
+
+    struct CoordHash
+    {
+        size_t operator()(const Coord& coord) const noexcept
+        {
+            size_t hash = 0;
+            for (int32_t c : coord)
+                hash = hash * 1099511628211ull ^ std::hash<int32_t>()(c);
+            return hash;
+        }
+    };
+
+    static bool TestBit(const uint64_t* mask, size_t bit) noexcept
+    {
+        return mask[bit >> 6] >> (bit & 63) & 1;
+    }
+
+    static bool TestBit(const std::vector<uint64_t>& mask, size_t bit) noexcept
+    {
+        return TestBit(mask.data(), bit);
+    }
+
+    template<size_t words>
+    static bool TestBit(const std::array<uint64_t, words>& mask, size_t bit) noexcept
+    {
+        return TestBit(mask.data(), bit);
+    }
+
+    static Coord RootKey(const Coord& coord) noexcept
+    {
+        Coord key;
+        for (size_t d = 0; d < dimensions; ++d)
+            key[d] = coord[d] >> spanLog2(0);     // arithmetic shift, rounds towards -infinity
+        return key;
+    }
+
+    // Index of the child (or value, for leaves) of a level's node which contains coord
+    static size_t Offset(const Coord& coord, size_t level) noexcept
+    {
+        const uint32_t lowMask = (uint32_t(1) << log2Dims[level]) - 1;
+        size_t offset = 0;
+        for (size_t d = 0; d < dimensions; ++d)
+            offset |= size_t(static_cast<uint32_t>(coord[d]) >> childLog2[level] & lowMask) << (log2Dims[level] * d);
+        return offset;
+    }
+
+    // Inverse of Offset: origin of a level's child at offset within the node at origin
+    static Coord Local(const Coord& origin, size_t offset, size_t level) noexcept
+    {
+        const size_t lowMask = (size_t(1) << log2Dims[level]) - 1;
+        Coord coord = origin;
+        for (size_t d = 0; d < dimensions; ++d)
+            coord[d] += static_cast<int32_t>((offset >> (log2Dims[level] * d) & lowMask) << childLog2[level]);
+        return coord;
+    }
+
+    uint32_t NewNode(size_t level)
+    {
+        if (level + 1 == numLevels)
+        {
+            mLeaves.emplace_back();
+            mLeaves.back().values.fill(mBackground);
+            return static_cast<uint32_t>(mLeaves.size() - 1);
+        }
+        const size_t numChildren = size_t(1) << (log2Dims[level] * dimensions);
+        mInternal[level].push_back({ std::vector<uint64_t>((numChildren + 63) / 64), std::vector<uint32_t>(numChildren) });
+        return static_cast<uint32_t>(mInternal[level].size() - 1);
+    }
+
+    [[nodiscard]] const Leaf* FindLeaf(const Coord& coord) const
+    {
+        auto found = mRoot.find(RootKey(coord));
+        if (found == mRoot.end())
+            return nullptr;
+        uint32_t index = found->second;
+        for (size_t level = 0; level + 1 < numLevels; ++level)
+        {
+            const Internal& node = mInternal[level][index];
+            const size_t offset = Offset(coord, level);
+            if (!TestBit(node.mask, offset))
+                return nullptr;
+            index = node.children[offset];
+        }
+        return &mLeaves[index];
+    }
+
+    [[nodiscard]] Leaf* FindLeaf(const Coord& coord)
+    {
+        return const_cast<Leaf*>(std::as_const(*this).FindLeaf(coord));
+    }
+
+    template<typename F>
+    void Visit(size_t level, uint32_t index, const Coord& origin, F& fn) const
+    {
+        if (level + 1 == numLevels)
+        {
+            const Leaf& leaf = mLeaves[index];
+            fn(origin, leaf.values.data(), leaf.mask.data());
+            return;
+        }
+        const Internal& node = mInternal[level][index];
+        for (size_t word = 0; word < node.mask.size(); ++word)
+            for (uint64_t bits = node.mask[word]; bits; bits &= bits - 1)
+            {
+                const size_t offset = word * 64 + OrthtreeLowestBit(bits);
+                Visit(level + 1, node.children[offset], Local(origin, offset, level), fn);
+            }
+    }
+
+    ValueT mBackground;
+    size_t mActiveCount = 0;
+    std::unordered_map<Coord, uint32_t, CoordHash> mRoot;
+    std::array<std::vector<Internal>, numLevels - 1> mInternal;
+    std::vector<Leaf> mLeaves;
 };
 
 #endif // ORTHTREE_H
@@ -0,0 +1,111 @@
+// Verlet lists and MovePoint: over a random-walk simulation, the pairs found through the
+// lists match brute force, only some lists are rebuilt per step, and moving points keeps
+// the tree consistent, with no leaf above bucketCapacity and no siblings left to merge.
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <set>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+typedef Orthtree<2> qt;
+
+// Points in the subtree under node, or npos if the subtree breaks an invariant
+static size_t CheckSubtree(const qt& tree, size_t index, size_t bucketCapacity)
+{
+    const qt::Node& node = tree[index];
+    if (node.isLeaf)
+    {
+        if (node.items.size() > bucketCapacity)
+            return qt::npos;
+        for (size_t item : node.items)
+            if (tree.LeafOf(item) != index || !node.ContainsPoint(tree.Point(item)))
+                return qt::npos;
+        return node.items.size();
+    }
+    size_t count = 0;
+    bool leafChildren = true;
+    for (size_t c = 0; c < 4; ++c)
+    {
+        const size_t child = node.firstChild + c;
+        const size_t childCount = tree.Parent(child) == index ? CheckSubtree(tree, child, bucketCapacity) : qt::npos;
+        if (childCount == qt::npos)
+            return qt::npos;
+        leafChildren &= tree[child].isLeaf;
+        count += childCount;
+    }
+    // Children which should have been merged back
+    return leafChildren && count <= bucketCapacity ? qt::npos : count;
+}
+
+static bool Consistent(const qt& tree, size_t bucketCapacity)
+{
+    size_t linked = 0;
+    for (size_t item = 0; item < tree.NumPoints(); ++item)
+        linked += tree.LeafOf(item) != qt::npos;
+    return CheckSubtree(tree, 0, bucketCapacity) == linked;
+}
+
+int main()
+{
+    std::mt19937 rng(6);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::normal_distribution<float> step(0.0f, 0.001f);
+    const size_t bucketCapacity = 8;
+    std::vector<qt::VecN> positions;
+    for (size_t i = 0; i < 2000; ++i)
+        positions.push_back({{ dist(rng) * 0.5f, dist(rng) }});
+    qt tree;
+    tree.Generate({{ 0, 0 }}, {{ 1, 1 }}, 12, positions, bucketCapacity);
+
+    const float cutoff = 0.03f, skin = 0.01f;
+    qt::VerletList lists(tree, cutoff, skin);
+    size_t updates = 0, rebuilt = 0, groups = 0;
+    bool pairsMatch = true, consistent = true;
+    for (size_t s = 0; s < 100; ++s)
+    {
+        // Drift right so that leaves empty on one side and fill on the other
+        for (auto& p : positions)
+            for (size_t d = 0; d < 2; ++d)
+                p[d] = std::clamp(p[d] + step(rng) + (d == 0 ? 0.0005f : 0.0f), 0.0f, 0.999f);
+        if (lists.Update(positions))
+        {
+            ++updates;
+            rebuilt += lists.NumRebuilt();
+            groups += lists.NumGroups();
+            consistent &= Consistent(tree, bucketCapacity);
+        }
+
+        std::set<std::pair<size_t, size_t>> found, expected;
+        lists.ForEachPair(positions, [&](size_t i, size_t j, float) {
+            static std::mutex mutex;
+            std::lock_guard<std::mutex> lock(mutex);
+            found.insert({ i, j });
+        });
+        for (size_t i = 0; i < positions.size(); ++i)
+            for (size_t j = 0; j < positions.size(); ++j)
+            {
+                const float dx = positions[i][0] - positions[j][0], dy = positions[i][1] - positions[j][1];
+                if (i != j && dx * dx + dy * dy < cutoff * cutoff)
+                    expected.insert({ i, j });
+            }
+        pairsMatch &= found == expected;
+    }
+    Check(pairsMatch, "Verlet pairs match brute force every step");
+    Check(consistent, "MovePoint keeps leaves split and merged");
+    Check(updates > 0 && rebuilt < groups, "updates rebuild only some lists");
+    std::printf("%zu updates rebuilt %zu of %zu lists\n", updates, rebuilt, groups);
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+// Forests: radius, box and kNN queries across tiles against brute force, points read back by
+// index, and tiles which stay put as more tiles are created
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+typedef OrthtreeForest<2> forest;
+
+int main()
+{
+    std::mt19937 rng(8);
+    std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+    forest points({{ 1.5f, 2.0f }}, 8, 4);
+    std::vector<forest::VecN> brute;
+    const forest::Tree* first = nullptr;
+    for (size_t i = 0; i < 4000; ++i)
+    {
+        const forest::VecN point = {{ dist(rng), dist(rng) * 0.5f }};
+        Check(points.Insert(point) == i, "indices follow insertion order");
+        brute.push_back(point);
+        if (!first)
+            first = points.FindTile(points.KeyOf(point));
+    }
+    Check(points.NumPoints() == brute.size(), "every point is counted");
+    Check(points.NumTiles() > 50, "points are spread over many tiles");
+    Check(first == points.FindTile(points.KeyOf(brute[0])), "tiles stay put as others are created");
+
+    bool stored = true;
+    for (size_t i = 0; i < brute.size(); ++i)
+        stored &= points.Point(i)[0] == brute[i][0] && points.Point(i)[1] == brute[i][1];
+    Check(stored, "Point reads back every point by index");
+
+    const forest copy = points;
+    for (size_t q = 0; q < 200; ++q)
+    {
+        const forest::VecN query = {{ dist(rng) * 1.1f, dist(rng) * 0.6f }};
+
+        const float radius = 0.1f + std::abs(dist(rng)) * 0.15f;
+        std::vector<size_t> inRadius = points.PointsInRadius(query, radius), expected;
+        for (size_t i = 0; i < brute.size(); ++i)
+            if (brute[i].Distance(query) <= radius)
+                expected.push_back(i);
+        std::sort(inRadius.begin(), inRadius.end());
+        Check(inRadius == expected, "PointsInRadius matches brute force");
+
+        const forest::VecN lower = query, upper = {{ query[0] + radius * 2, query[1] + radius }};
+        std::vector<size_t> inRange = points.PointsInRange(lower, upper);
+        expected.clear();
+        for (size_t i = 0; i < brute.size(); ++i)
+            if (lower[0] <= brute[i][0] && brute[i][0] <= upper[0] && lower[1] <= brute[i][1] && brute[i][1] <= upper[1])
+                expected.push_back(i);
+        std::sort(inRange.begin(), inRange.end());
+        Check(inRange == expected, "PointsInRange matches brute force");
+
+        const size_t k = 1 + q % 30;
+        std::vector<float> distances;
+        for (const auto& p : brute)
+            distances.push_back(p.Distance(query));
+        std::sort(distances.begin(), distances.end());
+        const std::vector<size_t> nearest = points.KNearest(query, k);
+        bool exact = nearest.size() == k;
+        for (size_t i = 0; exact && i < k; ++i)
+            exact = brute[nearest[i]].Distance(query) == distances[i];
+        Check(exact, "KNearest matches brute force");
+        Check(copy.KNearest(query, k) == nearest, "a copied forest answers the same");
+    }
+
+    bool threw = false;
+    try
+    {
+        (void)points.Point(brute.size());
+    }
+    catch (const std::out_of_range&)
+    {
+        threw = true;
+    }
+    Check(threw, "Point throws past the last index");
+    Check(points.PointsInRange({{ 1, 1 }}, {{ -1, -1 }}).empty(), "an inverted box holds nothing");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+// Periodic boxes: radius, box and kNN queries against minimum-image brute force, and points
+// outside the tree wrapped in by SetPeriodic, which keeps quantized points quantized
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+typedef Orthtree<3> ot;
+
+// Box of size 1 x 2 x 1, periodic along x and y
+static const float period[3] = { 1, 2, 0 };
+
+static float MinimumImageSqr(const ot::VecN& a, const ot::VecN& b)
+{
+    float sum = 0;
+    for (size_t d = 0; d < 3; ++d)
+    {
+        float diff = std::abs(a[d] - b[d]);
+        if (period[d] > 0)
+            diff = std::min(diff, period[d] - diff);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+// Compares the tree's queries around random positions with brute force over its own points
+static void CheckQueries(const ot& tree, std::mt19937& rng, const char* what)
+{
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<ot::VecN> points;
+    for (size_t i = 0; i < tree.NumPoints(); ++i)
+        points.push_back(tree.Point(i));
+    bool radiusMatch = true, knnMatch = true, rangeMatch = true;
+    for (size_t q = 0; q < 100; ++q)
+    {
+        // Queries given outside the box are wrapped in
+        const ot::VecN query = {{ dist(rng) * 3 - 1, dist(rng) * 4 - 1, dist(rng) }};
+        ot::VecN wrapped = query;
+        for (size_t d = 0; d < 2; ++d)
+            wrapped[d] -= std::floor(wrapped[d] / period[d]) * period[d];
+
+        // Radii up to half the box along the periodic axes, leaving out points on the sphere
+        const float radius = 0.05f + 0.4f * dist(rng);
+        std::vector<size_t> inRadius = tree.PointsInRadius(query, radius), expected;
+        std::sort(inRadius.begin(), inRadius.end());
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            const float dSqr = MinimumImageSqr(points[i], wrapped);
+            if (std::abs(dSqr - radius * radius) < 1e-5f)
+                inRadius.erase(std::remove(inRadius.begin(), inRadius.end(), i), inRadius.end());
+            else if (dSqr < radius * radius)
+                expected.push_back(i);
+        }
+        radiusMatch &= inRadius == expected;
+
+        const size_t k = 1 + q % 16;
+        std::vector<float> distances;
+        for (const auto& p : points)
+            distances.push_back(MinimumImageSqr(p, wrapped));
+        std::sort(distances.begin(), distances.end());
+        const std::vector<size_t> nearest = tree.KNearest(query, k);
+        knnMatch &= nearest.size() == k;
+        for (size_t i = 0; knnMatch && i < k; ++i)
+            knnMatch = std::abs(MinimumImageSqr(points[nearest[i]], wrapped) - distances[i]) < 1e-5f;
+
+        // A box across the seam at x = 1 covers leaves on both sides of it
+        const ot::VecN lower = {{ 0.9f, wrapped[1], 0.2f }}, upper = {{ 1.1f, wrapped[1] + 0.3f, 0.8f }};
+        std::vector<char> covered(points.size());
+        for (size_t leaf : tree.QueryRange(lower, upper))
+            for (size_t item : tree[leaf].items)
+                covered[item] = true;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            const ot::VecN& p = points[i];
+            const float x = p[0] < 0.5f ? p[0] + 1 : p[0];
+            const float y = p[1] < lower[1] ? p[1] + 2 : p[1];
+            if (lower[0] <= x && x <= upper[0] && y <= upper[1] && lower[2] <= p[2] && p[2] <= upper[2])
+                rangeMatch &= covered[i] != 0;
+        }
+    }
+    char message[128];
+    std::snprintf(message, sizeof(message), "%s: PointsInRadius matches minimum-image brute force", what);
+    Check(radiusMatch, message);
+    std::snprintf(message, sizeof(message), "%s: KNearest matches minimum-image brute force", what);
+    Check(knnMatch, message);
+    std::snprintf(message, sizeof(message), "%s: QueryRange wraps across the seam", what);
+    Check(rangeMatch, message);
+}
+
+int main()
+{
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<ot::VecN> points;
+    for (size_t i = 0; i < 3000; ++i)
+        points.push_back({{ dist(rng), dist(rng) * 2, dist(rng) }});
+    // Some points lie beyond the box along x or y, which only SetPeriodic brings in
+    std::vector<ot::VecN> outside;
+    for (size_t i = 0; i < 200; ++i)
+        outside.push_back({{ dist(rng) * 3 - 1, dist(rng) * 2 + (i % 2 ? 2.0f : -2.0f), dist(rng) }});
+    points.insert(points.end(), outside.begin(), outside.end());
+
+    ot periodic;
+    periodic.SetPeriodic({ true, true, false });
+    periodic.Generate({{ 0, 0, 0 }}, {{ 1, 2, 1 }}, 10, points, 8);
+    bool wrapped = true;
+    for (size_t i = 0; i < periodic.NumPoints(); ++i)
+        wrapped &= periodic.LeafOf(i) != ot::npos;
+    Check(wrapped, "Generate wraps every point into a periodic box");
+    CheckQueries(periodic, rng, "periodic");
+
+    // The same points, quantized first and made periodic afterwards
+    ot late;
+    late.Generate({{ 0, 0, 0 }}, {{ 1, 2, 1 }}, 10, points, 8);
+    late.QuantizePoints(16);
+    const size_t quantizedBytes = late.QuantizedBytes();
+    late.SetPeriodic({ true, true, false });
+    wrapped = true;
+    for (size_t i = 0; i < late.NumPoints(); ++i)
+        wrapped &= late.LeafOf(i) != ot::npos;
+    Check(wrapped, "SetPeriodic wraps the points outside the box in");
+    Check(late.QuantizedBytes() > 0 && late.QuantizedBytes() < quantizedBytes,
+          "SetPeriodic quantizes the wrapped points again");
+    bool close = true;
+    for (size_t i = 0; i < late.NumPoints(); ++i)
+        close &= MinimumImageSqr(late.Point(i), periodic.Point(i)) < 1e-6f;
+    Check(close, "quantized points stay where they were wrapped to");
+    CheckQueries(late, rng, "quantized");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
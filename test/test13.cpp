@@ -0,0 +1,158 @@
+// Quantized points: radius and kNN queries give the same results before and after
+// QuantizePoints for integer and float coordinates, whether the tree views the points (which
+// stay exact) or owns them (compared with brute force over the decoded points)
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+template<typename Tree>
+static double DistanceSqr(const typename Tree::VecN& a, const typename Tree::VecN& b)
+{
+    double sum = 0;
+    for (size_t d = 0; d < 2; ++d)
+        sum += (static_cast<double>(a[d]) - static_cast<double>(b[d])) * (static_cast<double>(a[d]) - static_cast<double>(b[d]));
+    return sum;
+}
+
+// Results of a batch of queries: points within each radius, sorted, then the k nearest
+// distances, which stay the same whichever of several equidistant points is returned
+template<typename Tree>
+struct Results
+{
+    std::vector<std::vector<size_t>> inRadius;
+    std::vector<std::vector<double>> nearest;
+
+    bool operator==(const Results& other) const
+    {
+        return inRadius == other.inRadius && nearest == other.nearest;
+    }
+};
+
+template<typename Tree, typename T>
+static Results<Tree> Query(const Tree& tree, const std::vector<typename Tree::VecN>& points, T scale)
+{
+    std::mt19937 rng(10);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    Results<Tree> results;
+    for (size_t q = 0; q < 100; ++q)
+    {
+        const typename Tree::VecN query = {{ static_cast<T>(dist(rng) * scale), static_cast<T>(dist(rng) * scale) }};
+        const T radius = static_cast<T>((0.01 + 0.05 * dist(rng)) * scale);
+        std::vector<size_t> inRadius = tree.PointsInRadius(query, radius);
+        std::sort(inRadius.begin(), inRadius.end());
+        results.inRadius.push_back(inRadius);
+        std::vector<double> distances;
+        for (size_t item : tree.KNearest(query, 1 + q % 12))
+            distances.push_back(DistanceSqr<Tree>(points[item], query));
+        results.nearest.push_back(distances);
+    }
+    return results;
+}
+
+template<typename Tree, typename T>
+static Results<Tree> BruteForce(const std::vector<typename Tree::VecN>& points, T scale)
+{
+    std::mt19937 rng(10);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    Results<Tree> results;
+    for (size_t q = 0; q < 100; ++q)
+    {
+        const typename Tree::VecN query = {{ static_cast<T>(dist(rng) * scale), static_cast<T>(dist(rng) * scale) }};
+        const T radius = static_cast<T>((0.01 + 0.05 * dist(rng)) * scale);
+        const double radiusSqr = static_cast<double>(radius) * static_cast<double>(radius);
+        std::vector<size_t> inRadius;
+        std::vector<double> distances;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            distances.push_back(DistanceSqr<Tree>(points[i], query));
+            if (distances.back() <= radiusSqr)
+                inRadius.push_back(i);
+        }
+        std::sort(distances.begin(), distances.end());
+        distances.resize(1 + q % 12);
+        results.inRadius.push_back(inRadius);
+        results.nearest.push_back(distances);
+    }
+    return results;
+}
+
+template<typename T>
+static void Run(const char* name, T scale)
+{
+    typedef Orthtree<2, T> Tree;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    std::vector<typename Tree::VecN> points;
+    std::vector<T> buffer;
+    for (size_t i = 0; i < 4000; ++i)
+    {
+        // Clustered, so that leaves range from the whole box down to a few units
+        const double spread = i % 2 ? 1.0 : 0.01;
+        points.push_back({{ static_cast<T>((0.3 + spread * (dist(rng) - 0.3)) * scale),
+                            static_cast<T>((0.6 + spread * (dist(rng) - 0.6)) * scale) }});
+        buffer.push_back(points.back()[0]);
+        buffer.push_back(points.back()[1]);
+    }
+    const typename Tree::VecN lower = {{ 0, 0 }}, upper = {{ scale, scale }};
+    const std::string prefix = name;
+
+    Tree viewed;
+    viewed.Generate(lower, upper, 12, Tree::PointView::AoS(buffer.data(), points.size()), 8);
+    const Results<Tree> exact = Query(viewed, points, scale);
+    Check(exact == BruteForce<Tree>(points, scale), prefix + ": queries match brute force");
+    for (unsigned bits : { 8u, 16u })
+    {
+        viewed.QuantizePoints(bits);
+        Check(viewed.QuantizedBytes() > 0, prefix + ": viewed points are quantized");
+        Check(Query(viewed, points, scale) == exact, prefix + ": quantizing viewed points keeps the results");
+    }
+
+    for (unsigned bits : { 8u, 16u })
+    {
+        Tree owned;
+        owned.Generate(lower, upper, 12, points, 8);
+        owned.QuantizePoints(bits);
+        Check(owned.Points().empty(), prefix + ": owned points are replaced by their codes");
+        std::vector<typename Tree::VecN> decoded;
+        bool inCell = true;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            decoded.push_back(owned.Point(i));
+            inCell &= owned[owned.LeafOf(i)].ContainsPoint(decoded.back());
+        }
+        Check(inCell, prefix + ": decoded points stay in their leaves");
+        Check(Query(owned, decoded, scale) == BruteForce<Tree>(decoded, scale),
+              prefix + ": quantized queries match brute force over the decoded points");
+        if constexpr (std::is_integral_v<T>)
+            if (bits == 16)
+            {
+                bool same = true;
+                for (size_t i = 0; i < points.size(); ++i)
+                    same &= decoded[i][0] == points[i][0] && decoded[i][1] == points[i][1];
+                Check(same, prefix + ": 16 bit codes hold integer points in leaves narrower than 65536 exactly");
+                Check(Query(owned, points, scale) == exact, prefix + ": so the results stay the same");
+            }
+    }
+}
+
+int main()
+{
+    Run<int>("int", 4096);
+    Run<float>("float", 1.0f);
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+// Runtime dimensions: DynamicOrthtree radius and kNN searches against brute force, both through
+// the Orthtree instantiations and above maxStaticDimensions, and temporaries refused at compile
+// time since the tree views its points
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <type_traits>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+template<typename Points, typename = void>
+struct CanGenerate : std::false_type {};
+
+template<typename Points>
+struct CanGenerate<Points, std::void_t<decltype(std::declval<DynamicOrthtree<float>&>().Generate(
+    std::declval<const std::vector<float>&>(), std::declval<const std::vector<float>&>(), size_t(),
+    std::declval<Points>(), size_t()))>> : std::true_type {};
+
+static_assert(CanGenerate<const std::vector<float>&>::value, "Generate views a vector which outlives the tree");
+static_assert(CanGenerate<std::vector<float>&>::value, "Generate views a vector which outlives the tree");
+static_assert(!CanGenerate<std::vector<float>>::value, "Generate refuses a temporary vector");
+static_assert(!std::is_constructible_v<Orthtree<2>::NavGraph, Orthtree<2>, std::function<bool(const Orthtree<2>::Node&)>>,
+              "NavGraph refuses a temporary tree");
+static_assert(!std::is_constructible_v<Orthtree<2>::BrickGrid<float>, Orthtree<2>, size_t>,
+              "BrickGrid refuses a temporary tree");
+
+static float DistanceSqr(const float* a, const float* b, size_t dimensions)
+{
+    float sum = 0;
+    for (size_t d = 0; d < dimensions; ++d)
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    return sum;
+}
+
+static void Run(size_t dimensions, bool fromPointer)
+{
+    const std::string name = std::to_string(dimensions) + "-D" + (fromPointer ? " from a pointer" : "");
+    std::mt19937 rng(static_cast<unsigned>(12 + dimensions));
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    const size_t count = 3000;
+    std::vector<float> points;
+    for (size_t i = 0; i < count * dimensions; ++i)
+        points.push_back(dist(rng) * dist(rng));
+    // One point outside the bounds, which the tree leaves out
+    points[0] = 1.5f;
+    const std::vector<float> lower(dimensions, 0.0f), upper(dimensions, 1.0f);
+
+    DynamicOrthtree<float> tree(dimensions);
+    if (fromPointer)
+        tree.Generate(lower, upper, 12, points.data(), count, 8);
+    else
+        tree.Generate(lower, upper, 12, points, 8);
+    Check(tree.NumPoints() == count, name + ": every point is counted");
+
+    bool radiusMatch = true, knnMatch = true;
+    std::vector<float> query(dimensions);
+    for (size_t q = 0; q < 100; ++q)
+    {
+        for (float& x : query)
+            x = dist(rng) * dist(rng);
+        const float radius = 0.2f + 0.1f * static_cast<float>(dimensions) * dist(rng) / 4;
+        std::vector<size_t> inRadius = tree.PointsInRadius(query.data(), radius), expected;
+        std::sort(inRadius.begin(), inRadius.end());
+        std::vector<float> distances;
+        for (size_t i = 1; i < count; ++i)
+        {
+            const float dSqr = DistanceSqr(points.data() + i * dimensions, query.data(), dimensions);
+            distances.push_back(dSqr);
+            // Points right on the sphere may go either way with rounding
+            if (std::abs(dSqr - radius * radius) < 1e-5f)
+                inRadius.erase(std::remove(inRadius.begin(), inRadius.end(), i), inRadius.end());
+            else if (dSqr < radius * radius)
+                expected.push_back(i);
+        }
+        radiusMatch &= inRadius == expected;
+
+        const size_t k = 1 + q % 20;
+        std::sort(distances.begin(), distances.end());
+        const std::vector<size_t> nearest = tree.KNearest(query.data(), k);
+        knnMatch &= nearest.size() == k;
+        for (size_t i = 0; knnMatch && i < k; ++i)
+            knnMatch = nearest[i] != 0 &&
+                       std::abs(DistanceSqr(points.data() + nearest[i] * dimensions, query.data(), dimensions) -
+                                distances[i]) <= 1e-5f * distances[i];
+    }
+    Check(radiusMatch, name + ": PointsInRadius matches brute force");
+    Check(knnMatch, name + ": KNearest matches brute force");
+}
+
+int main()
+{
+    for (size_t dimensions : { 3, 8, 9, 12, 20 })
+        Run(dimensions, false);
+    Run(16, true);
+    Check(DynamicOrthtree<float>(3).Get<3>() != nullptr, "3-D trees use Orthtree<3>");
+    Check(DynamicOrthtree<float>(12).Get<3>() == nullptr, "12-D trees use no Orthtree instantiation");
+
+    bool threw = false;
+    try
+    {
+        DynamicOrthtree<float> tree(10);
+        tree.Generate(std::vector<float>(10, 0.0f), std::vector<float>(10, 1.0f), 4, nullptr, 5, 8);
+    }
+    catch (const std::invalid_argument&)
+    {
+        threw = true;
+    }
+    Check(threw, "Generate throws on a missing buffer");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+// Van Emde Boas layout: reordering the nodes keeps every point in its leaf, with its quantized
+// code, and keeps query results; Serialize and Deserialize then round trip the reordered tree
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+typedef Orthtree<3> ot;
+
+static bool Same(const ot::VecN& a, const ot::VecN& b)
+{
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+// Points within radius and k nearest of a fixed set of queries
+static std::vector<std::vector<size_t>> Query(const ot& tree)
+{
+    std::mt19937 rng(13);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<std::vector<size_t>> results;
+    for (size_t q = 0; q < 100; ++q)
+    {
+        const ot::VecN query = {{ dist(rng), dist(rng), dist(rng) }};
+        std::vector<size_t> inRadius = tree.PointsInRadius(query, 0.02f + 0.1f * dist(rng));
+        std::sort(inRadius.begin(), inRadius.end());
+        results.push_back(inRadius);
+        results.push_back(tree.KNearest(query, 1 + q % 10));
+    }
+    return results;
+}
+
+// Every point is linked to a leaf which lists it and contains it
+static bool Linked(const ot& tree)
+{
+    for (size_t item = 0; item < tree.NumPoints(); ++item)
+    {
+        const size_t leaf = tree.LeafOf(item);
+        if (leaf == ot::npos || !tree[leaf].isLeaf || !tree[leaf].ContainsPoint(tree.Point(item)))
+            return false;
+        const auto& items = tree[leaf].items;
+        if (std::find(items.begin(), items.end(), item) == items.end())
+            return false;
+    }
+    return true;
+}
+
+static void Run(ot& tree, const std::string& name)
+{
+    std::vector<ot::VecN> before;
+    for (size_t item = 0; item < tree.NumPoints(); ++item)
+        before.push_back(tree.Point(item));
+    const auto results = Query(tree);
+    const size_t quantizedBytes = tree.QuantizedBytes();
+    Check(quantizedBytes > 0, name + ": points are quantized");
+
+    tree.ReorderVanEmdeBoas();
+    Check(tree.GetLayout() == ot::NodeLayout::VanEmdeBoas, name + ": layout is van Emde Boas");
+    Check(tree.QuantizedBytes() == quantizedBytes, name + ": reordering keeps the codes");
+    bool same = true;
+    for (size_t item = 0; item < tree.NumPoints(); ++item)
+        same &= Same(tree.Point(item), before[item]);
+    Check(same, name + ": codes decode to the same points after reordering");
+    Check(Linked(tree), name + ": points stay linked to their leaves");
+    Check(Query(tree) == results, name + ": queries give the same results after reordering");
+
+    std::stringstream stream;
+    tree.Serialize(stream);
+    ot loaded;
+    loaded.Deserialize(stream);
+    Check(loaded.GetLayout() == ot::NodeLayout::VanEmdeBoas, name + ": the layout survives serialization");
+    bool nodes = loaded.Size() == tree.Size();
+    for (size_t i = 0; nodes && i < tree.Size(); ++i)
+        nodes = Same(loaded[i].pos, tree[i].pos) && Same(loaded[i].size, tree[i].size) &&
+                loaded[i].isLeaf == tree[i].isLeaf && (tree[i].isLeaf || loaded[i].firstChild == tree[i].firstChild) &&
+                loaded[i].items == tree[i].items && loaded[i].level == tree[i].level;
+    Check(nodes, name + ": nodes survive serialization in place");
+    same = loaded.NumPoints() == tree.NumPoints();
+    for (size_t item = 0; same && item < tree.NumPoints(); ++item)
+        same = Same(loaded.Point(item), tree.Point(item)) && loaded.LeafOf(item) == tree.LeafOf(item);
+    Check(same, name + ": points survive serialization");
+    Check(Query(loaded) == results, name + ": the loaded tree gives the same results");
+}
+
+int main()
+{
+    std::mt19937 rng(14);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<ot::VecN> points;
+    std::vector<float> buffer;
+    for (size_t i = 0; i < 6000; ++i)
+    {
+        points.push_back({{ dist(rng), dist(rng) * dist(rng), dist(rng) }});
+        buffer.insert(buffer.end(), { points.back()[0], points.back()[1], points.back()[2] });
+    }
+
+    ot owned;
+    owned.Generate({{ 0, 0, 0 }}, {{ 1, 1, 1 }}, 10, points, 8);
+    owned.QuantizePoints(8);
+    Run(owned, "owned");
+
+    ot viewed;
+    viewed.Generate({{ 0, 0, 0 }}, {{ 1, 1, 1 }}, 10, ot::PointView::AoS(buffer.data(), points.size()), 8);
+    viewed.QuantizePoints(16);
+    Run(viewed, "viewed");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
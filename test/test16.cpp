@@ -0,0 +1,214 @@
+// Paged trees: PagedOrthtree over the output of WritePages answers box, radius and kNN queries
+// like the tree it was written from, with a budget small enough to evict pages, with the
+// pages held in memory, on a thread pool and from several threads at once
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+typedef Orthtree<3> ot;
+typedef PagedOrthtree<3> paged;
+
+struct Query
+{
+    ot::VecN centre, lower, upper;
+    float radius;
+    size_t k;
+};
+
+static float DistanceSqr(const ot::VecN& a, const ot::VecN& b)
+{
+    float sum = 0;
+    for (size_t d = 0; d < 3; ++d)
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    return sum;
+}
+
+// Results of the queries: points in the box and in the sphere, sorted, and the distances to
+// the k nearest, which do not depend on how ties are broken
+struct Results
+{
+    std::vector<std::vector<size_t>> inRange, inRadius;
+    std::vector<std::vector<float>> nearest;
+
+    bool operator==(const Results& other) const
+    {
+        return inRange == other.inRange && inRadius == other.inRadius && nearest == other.nearest;
+    }
+};
+
+template<typename Tree>
+static Results Run(const Tree& tree, const std::vector<ot::VecN>& points, const std::vector<Query>& queries)
+{
+    Results results;
+    for (const Query& query : queries)
+    {
+        std::vector<size_t> inRange = tree.PointsInRange(query.lower, query.upper);
+        std::sort(inRange.begin(), inRange.end());
+        results.inRange.push_back(inRange);
+        std::vector<size_t> inRadius = tree.PointsInRadius(query.centre, query.radius);
+        std::sort(inRadius.begin(), inRadius.end());
+        results.inRadius.push_back(inRadius);
+        std::vector<float> distances;
+        for (size_t item : tree.KNearest(query.centre, query.k))
+            distances.push_back(DistanceSqr(points[item], query.centre));
+        results.nearest.push_back(distances);
+    }
+    return results;
+}
+
+static Results BruteForce(const std::vector<ot::VecN>& points, const std::vector<Query>& queries)
+{
+    Results results;
+    for (const Query& query : queries)
+    {
+        std::vector<size_t> inRange, inRadius;
+        std::vector<float> distances;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            const ot::VecN& p = points[i];
+            bool inside = true;
+            for (size_t d = 0; d < 3; ++d)
+                inside &= query.lower[d] <= p[d] && p[d] <= query.upper[d];
+            if (inside)
+                inRange.push_back(i);
+            distances.push_back(DistanceSqr(p, query.centre));
+            if (distances.back() <= query.radius * query.radius)
+                inRadius.push_back(i);
+        }
+        std::sort(distances.begin(), distances.end());
+        distances.resize(query.k);
+        results.inRange.push_back(inRange);
+        results.inRadius.push_back(inRadius);
+        results.nearest.push_back(distances);
+    }
+    return results;
+}
+
+// The in-memory tree answers boxes through its leaves, so filter them as the paged tree does
+struct InMemory
+{
+    const ot& tree;
+
+    std::vector<size_t> PointsInRange(const ot::VecN& lower, const ot::VecN& upper) const
+    {
+        std::vector<size_t> result;
+        for (size_t leaf : tree.QueryRange(lower, upper))
+            for (size_t item : tree[leaf].items)
+            {
+                bool inside = true;
+                for (size_t d = 0; d < 3; ++d)
+                    inside &= lower[d] <= tree.Point(item)[d] && tree.Point(item)[d] <= upper[d];
+                if (inside)
+                    result.push_back(item);
+            }
+        return result;
+    }
+
+    std::vector<size_t> PointsInRadius(const ot::VecN& centre, float radius) const
+    {
+        return tree.PointsInRadius(centre, radius);
+    }
+
+    std::vector<size_t> KNearest(const ot::VecN& point, size_t k) const
+    {
+        return tree.KNearest(point, k);
+    }
+};
+
+int main()
+{
+    std::mt19937 rng(15);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<ot::VecN> points;
+    for (size_t i = 0; i < 20000; ++i)
+        points.push_back({{ dist(rng), dist(rng) * dist(rng), dist(rng) }});
+    // A point outside the tree, which is counted but lies beyond every query
+    points.push_back({{ 2, 0.5f, 0.5f }});
+    ot tree;
+    tree.Generate({{ 0, 0, 0 }}, {{ 1, 1, 1 }}, 10, points, 8);
+
+    std::vector<Query> queries;
+    for (size_t q = 0; q < 100; ++q)
+    {
+        Query query;
+        query.centre = ot::VecN{{ dist(rng), dist(rng) * 0.5f, dist(rng) }};
+        query.radius = 0.02f + 0.08f * dist(rng);
+        query.k = 1 + q % 20;
+        for (size_t d = 0; d < 3; ++d)
+        {
+            query.lower[d] = query.centre[d] - query.radius;
+            query.upper[d] = query.centre[d] + 2 * query.radius;
+        }
+        queries.push_back(query);
+    }
+    const Results expected = BruteForce(points, queries);
+    Check(Run(InMemory{ tree }, points, queries) == expected, "the tree matches brute force");
+
+    for (size_t pageLevels : { 1, 3, 6 })
+    {
+        const std::string name = std::to_string(pageLevels) + " levels per page";
+        std::stringstream file;
+        tree.WritePages(file, pageLevels);
+
+        // A budget of a few pages, so that pages are evicted and read again
+        paged small(file, 16 << 10);
+        Check(small.NumPoints() == points.size(), name + ": every point is counted");
+        Check(Run(small, points, queries) == expected, name + ": paged queries match brute force");
+        Check(pageLevels == 6 || small.PageLoads() > small.NumPages(), name + ": a small budget evicts pages");
+
+        // The same stream read again with room for every page
+        file.clear();
+        file.seekg(0);
+        paged large(file, size_t(1) << 30);
+        Check(Run(large, points, queries) == expected, name + ": queries match with every page cached");
+        Check(large.PageLoads() <= large.NumPages(), name + ": pages stay cached within the budget");
+        const size_t loads = large.PageLoads();
+        Check(Run(large, points, queries) == expected && large.PageLoads() == loads,
+              name + ": repeated queries read no more pages");
+    }
+
+    // Concurrent queries, with pages prefetched on a pool, against a budget which evicts
+    std::stringstream file;
+    tree.WritePages(file, 2);
+    OrthtreeThreadPool pool(4);
+    paged shared(file, 64 << 10);
+    shared.SetThreadPool(&pool);
+    std::vector<char> match(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < match.size(); ++t)
+        threads.emplace_back([&, t] { match[t] = Run(shared, points, queries) == expected; });
+    for (auto& thread : threads)
+        thread.join();
+    Check(std::count(match.begin(), match.end(), 1) == 4, "concurrent queries on a pool match brute force");
+
+    bool threw = false;
+    try
+    {
+        std::stringstream serialized;
+        tree.Serialize(serialized);
+        paged wrong(serialized, 1 << 20);
+    }
+    catch (const std::runtime_error&)
+    {
+        threw = true;
+    }
+    Check(threw, "a serialized tree is not read as a paged tree");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+// Progressive serialization: SerializeProgressive round trips, partial loads up to a level
+// hold a consistent sample which queries like brute force over it, and loads resumed level by
+// level or from a stream still being written end with the whole tree
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+typedef Orthtree<3> ot;
+
+static bool Same(const ot::VecN& a, const ot::VecN& b)
+{
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+// Whether two trees hold the same points under the same indices and give the same kNN results
+static bool SameTree(const ot& a, const ot& b, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    if (a.NumPoints() != b.NumPoints() || a.Size() != b.Size())
+        return false;
+    for (size_t item = 0; item < a.NumPoints(); ++item)
+        if (!Same(a.Point(item), b.Point(item)) || (a.LeafOf(item) == ot::npos) != (b.LeafOf(item) == ot::npos))
+            return false;
+    for (size_t q = 0; q < 50; ++q)
+    {
+        const ot::VecN query = {{ dist(rng), dist(rng), dist(rng) }};
+        if (a.KNearest(query, 10) != b.KNearest(query, 10))
+            return false;
+    }
+    return true;
+}
+
+// Whether every point of a partly loaded tree is one of the original's, linked to a leaf
+// containing it, and kNN queries agree with brute force over the points read so far
+static bool ConsistentSample(const ot& partial, const ot& original, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    for (size_t item = 0; item < partial.NumPoints(); ++item)
+    {
+        const size_t leaf = partial.LeafOf(item);
+        if (!Same(partial.Point(item), original.Point(partial.SerializedIndex(item))) || leaf == ot::npos ||
+            !partial[leaf].isLeaf || !partial[leaf].ContainsPoint(partial.Point(item)))
+            return false;
+    }
+    for (size_t q = 0; q < 50; ++q)
+    {
+        const ot::VecN query = {{ dist(rng), dist(rng), dist(rng) }};
+        std::vector<float> distances;
+        for (size_t item = 0; item < partial.NumPoints(); ++item)
+            distances.push_back(partial.Point(item).Distance(query));
+        std::sort(distances.begin(), distances.end());
+        const std::vector<size_t> nearest = partial.KNearest(query, 5);
+        if (nearest.size() != std::min<size_t>(5, distances.size()))
+            return false;
+        for (size_t i = 0; i < nearest.size(); ++i)
+            if (partial.Point(nearest[i]).Distance(query) != distances[i])
+                return false;
+    }
+    return true;
+}
+
+int main()
+{
+    std::mt19937 rng(16);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<ot::VecN> points;
+    for (size_t i = 0; i < 20000; ++i)
+        points.push_back({{ dist(rng), dist(rng), dist(rng) * dist(rng) }});
+    ot tree;
+    tree.Generate({{ 0, 0, 0 }}, {{ 1, 1, 1 }}, 9, points, 8);
+    // Inserted blocks give a mixed layout, then reordered; one point moved outside the tree
+    for (size_t i = 0; i < 100; ++i)
+        tree.Insert({{ dist(rng) * 0.05f, dist(rng) * 0.05f, dist(rng) * 0.05f }});
+    tree.MovePoint(3, {{ 5, 5, 5 }});
+    tree.ReorderVanEmdeBoas();
+
+    std::stringstream file;
+    tree.SerializeProgressive(file);
+    const std::string bytes = file.str();
+
+    size_t numLevels = 0;
+    {
+        std::stringstream in(bytes);
+        ot loaded;
+        numLevels = loaded.DeserializeProgressive(in);
+        Check(!loaded.IsPartiallyLoaded(), "a whole load completes");
+        Check(SameTree(loaded, tree, rng), "a whole load gives back the tree");
+        Check(loaded.LeafOf(3) == ot::npos && Same(loaded.Point(3), tree.Point(3)), "points outside the tree are kept");
+        loaded.Insert({{ 0.5f, 0.5f, 0.5f }});
+        Check(loaded.NumPoints() == tree.NumPoints() + 1, "a loaded tree can be changed");
+    }
+    Check(numLevels > 4, "the tree has several levels");
+
+    for (size_t maxLevel = 0; maxLevel < 4; ++maxLevel)
+    {
+        const std::string name = "up to level " + std::to_string(maxLevel);
+        std::stringstream in(bytes);
+        ot partial;
+        Check(partial.DeserializeProgressive(in, maxLevel) == maxLevel + 1, name + ": reads the levels asked for");
+        Check(partial.IsPartiallyLoaded(), name + ": the load is partial");
+        Check(partial.NumPoints() > 0 && partial.NumPoints() < tree.NumPoints(), name + ": holds a sample of the points");
+        Check(ConsistentSample(partial, tree, rng), name + ": the sample is consistent and queries match brute force");
+
+        bool threw = false;
+        try
+        {
+            partial.Insert({{ 0.5f, 0.5f, 0.5f }});
+        }
+        catch (const std::logic_error&)
+        {
+            threw = true;
+        }
+        Check(threw, name + ": a partial tree cannot be changed");
+
+        // One more level, then the rest
+        const size_t points = partial.NumPoints();
+        Check(partial.RefineProgressive(in, maxLevel + 1) == maxLevel + 2 && partial.NumPoints() > points,
+              name + ": refining reads one more level");
+        partial.RefineProgressive(in);
+        Check(!partial.IsPartiallyLoaded() && SameTree(partial, tree, rng), name + ": resuming ends with the whole tree");
+    }
+
+    // A stream which grows as the file arrives
+    {
+        std::stringstream in;
+        const size_t chunk = bytes.size() / 37;
+        in.write(bytes.data(), static_cast<std::streamsize>(chunk));
+        ot growing;
+        growing.DeserializeProgressive(in);
+        bool consistent = true;
+        for (size_t at = chunk; growing.IsPartiallyLoaded() && at < bytes.size(); at += chunk)
+        {
+            in.clear();
+            in.seekp(0, std::ios::end);
+            in.write(bytes.data() + at, static_cast<std::streamsize>(std::min(chunk, bytes.size() - at)));
+            growing.RefineProgressive(in);
+            for (size_t item = 0; growing.IsPartiallyLoaded() && item < growing.NumPoints(); ++item)
+                consistent &= Same(growing.Point(item), tree.Point(growing.SerializedIndex(item)));
+        }
+        Check(consistent, "a growing stream gives consistent samples");
+        Check(!growing.IsPartiallyLoaded() && SameTree(growing, tree, rng), "a growing stream ends with the whole tree");
+    }
+
+    // Loaded into compact points, and an empty tree
+    {
+        std::stringstream in(bytes);
+        Orthtree<3, float, uint16_t> compact;
+        compact.DeserializeProgressive(in, 2);
+        compact.RefineProgressive(in);
+        Check(compact.NumPoints() == tree.NumPoints() && compact.Points().empty(), "compact trees load progressively");
+
+        std::stringstream empty;
+        ot().SerializeProgressive(empty);
+        ot loaded;
+        Check(loaded.DeserializeProgressive(empty) == 0 && !loaded.IsPartiallyLoaded(), "an empty tree round trips");
+    }
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
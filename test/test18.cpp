@@ -0,0 +1,143 @@
+// Compressed serialization: SerializeCompressed round trips trees of several coordinate types,
+// dimensions and block sizes exactly, CompressedReader finds the points of any leaf, and
+// truncated streams are refused
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+template<typename Tree>
+static bool Same(const typename Tree::VecN& a, const typename Tree::VecN& b, size_t dimensions)
+{
+    for (size_t d = 0; d < dimensions; ++d)
+        if (a[d] != b[d])
+            return false;
+    return true;
+}
+
+template<size_t dimensions, typename T, typename PointT = T>
+static void Run(const std::string& name, size_t blockNodes, bool grow)
+{
+    typedef Orthtree<dimensions, T, PointT> Tree;
+    typedef typename Tree::VecN VecN;
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    std::vector<VecN> points(20000);
+    for (VecN& point : points)
+        for (size_t d = 0; d < dimensions; ++d)
+            point[d] = static_cast<T>(dist(rng) * dist(rng) * 1000);
+    VecN lower, upper;
+    for (size_t d = 0; d < dimensions; ++d)
+    {
+        lower[d] = 0;
+        upper[d] = 1024;
+    }
+    Tree tree;
+    tree.Generate(lower, upper, 8, points, 4);
+    if (grow)
+    {
+        // Grows the root, so that some boxes no longer follow from their parent's
+        VecN far;
+        for (size_t d = 0; d < dimensions; ++d)
+            far[d] = static_cast<T>(-500 - 300 * dist(rng));
+        tree.Insert(far);
+        tree.MovePoint(5, far);
+    }
+
+    std::stringstream plain, compressed;
+    tree.Serialize(plain);
+    tree.SerializeCompressed(compressed, blockNodes);
+    const std::string bytes = compressed.str();
+    Check(bytes.size() < plain.str().size(), name + ": the compressed tree is smaller");
+
+    Tree loaded;
+    loaded.DeserializeCompressed(compressed);
+    Check(loaded.Size() == tree.Size() && loaded.NumPoints() == tree.NumPoints(), name + ": every node and point is read");
+    bool exact = true, leaves = true;
+    for (size_t item = 0; item < tree.NumPoints(); ++item)
+    {
+        exact &= Same<Tree>(loaded.Point(item), tree.Point(item), dimensions);
+        const size_t a = loaded.LeafOf(item), b = tree.LeafOf(item);
+        leaves &= (a == Tree::npos) == (b == Tree::npos) &&
+                  (a == Tree::npos || (Same<Tree>(loaded[a].pos, tree[b].pos, dimensions) &&
+                                       Same<Tree>(loaded[a].size, tree[b].size, dimensions) &&
+                                       loaded[a].items.size() == tree[b].items.size()));
+    }
+    Check(exact, name + ": points are exact");
+    Check(leaves, name + ": points are in leaves of the same box");
+
+    std::stringstream again(bytes);
+    const typename Tree::CompressedReader reader(again);
+    Check(reader.NumNodes() == tree.Size() && reader.NumPoints() == tree.NumPoints(), name + ": the reader reads the header");
+    bool found = true;
+    for (size_t q = 0; q < 200; ++q)
+    {
+        const size_t item = static_cast<size_t>(dist(rng) * static_cast<double>(tree.NumPoints()));
+        const size_t leaf = tree.LeafOf(item);
+        std::vector<std::pair<size_t, VecN>> inLeaf = reader.PointsInLeaf(tree.Point(item));
+        if (leaf == Tree::npos)
+        {
+            found &= inLeaf.empty();
+            continue;
+        }
+        std::vector<size_t> items;
+        for (const auto& [index, point] : inLeaf)
+        {
+            items.push_back(index);
+            found &= Same<Tree>(point, tree.Point(index), dimensions);
+        }
+        std::vector<size_t> expected = tree[leaf].items;
+        std::sort(items.begin(), items.end());
+        std::sort(expected.begin(), expected.end());
+        found &= items == expected;
+    }
+    Check(found, name + ": the reader finds the points of a leaf");
+
+    bool refused = true;
+    for (size_t cut : { size_t(3), bytes.size() / 3, bytes.size() - 1 })
+    {
+        std::stringstream truncated(bytes.substr(0, cut));
+        try
+        {
+            Tree broken;
+            broken.DeserializeCompressed(truncated);
+            refused = false;
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+    Check(refused, name + ": truncated streams throw");
+}
+
+int main()
+{
+    Run<3, float>("float, 1 node per block", 1, false);
+    Run<3, float>("float, 4096 nodes per block", 4096, true);
+    Run<3, double>("double", 512, true);
+    Run<2, int>("int", 100, true);
+    Run<3, float, uint16_t>("uint16 payload", 4096, false);
+    Run<8, float>("8-D", 50, false);
+
+    Orthtree<3> empty, loaded;
+    std::stringstream stream;
+    empty.SerializeCompressed(stream);
+    loaded.DeserializeCompressed(stream);
+    Check(loaded.Size() == 0 && loaded.NumPoints() == 0, "an empty tree round trips");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
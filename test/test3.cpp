@@ -0,0 +1,96 @@
+// Thread pool: a tree generated on the pool matches one generated serially, and exceptions
+// thrown by tasks reach the caller
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+int main()
+{
+    typedef Orthtree<3> ot;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<ot::VecN> points;
+    for (size_t i = 0; i < 50000; ++i)
+        points.push_back({{ dist(rng), dist(rng) * dist(rng), dist(rng) }});
+
+    OrthtreeThreadPool pool(4);
+    ot serial, parallel;
+    serial.Generate({{ 0, 0, 0 }}, {{ 1, 1, 1 }}, 10, points, 8);
+    parallel.SetThreadPool(&pool);
+    parallel.Generate({{ 0, 0, 0 }}, {{ 1, 1, 1 }}, 10, points, 8);
+    bool same = serial.Size() == parallel.Size();
+    for (size_t i = 0; same && i < serial.Size(); ++i)
+        same = serial[i].isLeaf == parallel[i].isLeaf && serial[i].firstChild == parallel[i].firstChild &&
+               serial[i].items == parallel[i].items;
+    Check(same, "parallel Generate builds the same tree");
+
+    // ParallelFor rethrows the first exception on the calling thread
+    bool caught = false;
+    try
+    {
+        pool.ParallelFor(0, 1000, 1, [](size_t begin, size_t) {
+            if (begin == 500)
+                throw std::runtime_error("chunk 500");
+        });
+    }
+    catch (const std::runtime_error&)
+    {
+        caught = true;
+    }
+    Check(caught, "ParallelFor rethrows");
+
+    // A submitted task's exception is kept for TakeException instead of ending the process
+    std::atomic<bool> ran{false};
+    pool.Submit([] { throw std::logic_error("submitted"); });
+    pool.Submit([&] { ran = true; });
+    for (int i = 0; i < 2000 && !ran; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::exception_ptr error;
+    for (int i = 0; i < 2000 && !error; ++i)
+    {
+        error = pool.TakeException();
+        if (!error)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    Check(ran, "workers keep running after a task throws");
+    caught = false;
+    try
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+    catch (const std::logic_error&)
+    {
+        caught = true;
+    }
+    Check(caught, "TakeException returns the task's exception");
+    Check(!pool.TakeException(), "TakeException clears the exception");
+
+    // Without workers tasks run inline and throw to the caller
+    OrthtreeThreadPool inlinePool(0);
+    caught = false;
+    try
+    {
+        inlinePool.Submit([] { throw std::logic_error("inline"); });
+    }
+    catch (const std::logic_error&)
+    {
+        caught = true;
+    }
+    Check(caught, "inline Submit throws");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
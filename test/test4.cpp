@@ -0,0 +1,46 @@
+// LocateBatch: gives the same leaves as a Locate loop, and times both. The gain depends on
+// how far the nodes exceed the caches: pass the number of points to try other tree sizes.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "Orthtree.h"
+
+int main(int argc, char** argv)
+{
+    typedef Orthtree<3> ot;
+    const size_t numPoints = argc > 1 ? static_cast<size_t>(std::atol(argv[1])) : 2000000;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<ot::VecN> points, queries;
+    for (size_t i = 0; i < numPoints; ++i)
+        points.push_back({{ dist(rng), dist(rng), dist(rng) }});
+    for (size_t i = 0; i < 2000000; ++i)
+        queries.push_back({{ dist(rng), dist(rng), dist(rng) }});
+
+    ot tree;
+    tree.Generate({{ 0, 0, 0 }}, {{ 1, 1, 1 }}, 12, points, 4);
+    std::printf("%zu nodes, %zu MB\n", tree.Size(), tree.Size() * sizeof(ot::Node) >> 20);
+
+    int failures = 0;
+    for (int run = 0; run < 3; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<size_t> looped;
+        looped.reserve(queries.size());
+        for (const auto& query : queries)
+            looped.push_back(tree.Locate(query));
+        auto middle = std::chrono::steady_clock::now();
+        std::vector<size_t> batched = tree.LocateBatch(queries);
+        auto end = std::chrono::steady_clock::now();
+        if (batched != looped)
+        {
+            std::printf("FAILED: LocateBatch differs from Locate\n");
+            ++failures;
+        }
+        std::printf("Locate loop %.0f ms, LocateBatch %.0f ms\n",
+                    std::chrono::duration<double, std::milli>(middle - start).count(),
+                    std::chrono::duration<double, std::milli>(end - middle).count());
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+// Query cache: cached box and radius queries match uncached ones, from concurrent readers,
+// and rebuilding or invalidating a region drops the affected lists
+#include <cstdio>
+#include <random>
+#include <thread>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+int main()
+{
+    typedef Orthtree<2> qt;
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<qt::VecN> points;
+    for (size_t i = 0; i < 20000; ++i)
+        points.push_back({{ dist(rng), dist(rng) }});
+    qt tree;
+    tree.Generate({{ 0, 0 }}, {{ 1, 1 }}, 12, points, 8);
+    tree.EnableQueryCache(1 << 20);
+
+    std::vector<qt::VecN> centres;
+    for (size_t i = 0; i < 64; ++i)
+        centres.push_back({{ dist(rng), dist(rng) }});
+
+    // Readers share the cache, each query repeated so that hits and misses interleave
+    std::vector<std::thread> readers;
+    std::atomic<int> mismatches{0};
+    for (size_t r = 0; r < 4; ++r)
+        readers.emplace_back([&, r] {
+            for (size_t i = 0; i < 256; ++i)
+            {
+                const qt::VecN& centre = centres[(i * 7 + r) % centres.size()];
+                qt::VecN lower = centre, upper = centre;
+                for (size_t d = 0; d < 2; ++d)
+                {
+                    lower[d] -= 0.05f;
+                    upper[d] += 0.05f;
+                }
+                if (*tree.CachedQueryRange(lower, upper) != tree.QueryRange(lower, upper) ||
+                    *tree.CachedQueryRadius(centre, 0.05f) != tree.QueryRadius(centre, 0.05f))
+                    ++mismatches;
+            }
+        });
+    for (auto& reader : readers)
+        reader.join();
+    Check(mismatches == 0, "cached queries match uncached ones across threads");
+
+    const qt::VecN near = {{ 0.1f, 0.1f }}, far = {{ 0.9f, 0.9f }};
+    auto nearList = tree.CachedQueryRadius(near, 0.05f);
+    auto farList = tree.CachedQueryRadius(far, 0.05f);
+    Check(tree.CachedQueryRadius(near, 0.05f) == nearList, "a repeated query returns the cached list");
+
+    tree.InvalidateRegion({{ 0.0f, 0.0f }}, {{ 0.2f, 0.2f }});
+    Check(tree.CachedQueryRadius(near, 0.05f) != nearList, "InvalidateRegion drops overlapping lists");
+    Check(tree.CachedQueryRadius(far, 0.05f) == farList, "InvalidateRegion keeps other lists");
+
+    // Splitting leaves changes the tree's version, which clears the whole cache
+    for (size_t i = 0; i < 200; ++i)
+        tree.Insert({{ 0.9f + dist(rng) * 0.01f, 0.9f + dist(rng) * 0.01f }});
+    auto refreshed = tree.CachedQueryRadius(far, 0.05f);
+    Check(refreshed != farList, "rebuilding invalidates the cache");
+    Check(*refreshed == tree.QueryRadius(far, 0.05f), "lists after a rebuild match the new tree");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
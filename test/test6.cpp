@@ -0,0 +1,74 @@
+// k nearest neighbours: KNearest, KNearestApprox and PointsInRadius against brute force
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+typedef Orthtree<3> ot;
+
+// Distances from point to the k closest of points, nearest first
+static std::vector<float> BruteForce(const std::vector<ot::VecN>& points, const ot::VecN& point, size_t k)
+{
+    std::vector<float> distances;
+    for (const auto& p : points)
+        distances.push_back(p.Distance(point));
+    std::sort(distances.begin(), distances.end());
+    distances.resize(std::min(k, distances.size()));
+    return distances;
+}
+
+int main()
+{
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<ot::VecN> points;
+    for (size_t i = 0; i < 5000; ++i)
+        points.push_back({{ dist(rng), dist(rng) * dist(rng), dist(rng) }});
+    ot tree;
+    tree.Generate({{ 0, 0, 0 }}, {{ 1, 1, 1 }}, 10, points, 8);
+
+    for (size_t q = 0; q < 200; ++q)
+    {
+        // Queries inside and just outside the tree
+        const ot::VecN query = {{ dist(rng) * 1.2f - 0.1f, dist(rng), dist(rng) }};
+        const size_t k = 1 + q % 20;
+        const std::vector<float> expected = BruteForce(points, query, k);
+
+        const std::vector<size_t> nearest = tree.KNearest(query, k);
+        bool exact = nearest.size() == expected.size();
+        for (size_t i = 0; exact && i < nearest.size(); ++i)
+            exact = points[nearest[i]].Distance(query) == expected[i];
+        Check(exact, "KNearest matches brute force");
+
+        const float epsilon = 0.5f;
+        const std::vector<size_t> approx = tree.KNearestApprox(query, k, epsilon);
+        bool bounded = approx.size() == expected.size();
+        for (size_t i = 0; bounded && i < approx.size(); ++i)
+            bounded = points[approx[i]].Distance(query) <= expected[i] * (1.0f + epsilon) + 1e-6f;
+        Check(bounded, "KNearestApprox stays within 1 + epsilon");
+
+        const float radius = 0.02f + 0.1f * dist(rng);
+        std::vector<size_t> inRadius = tree.PointsInRadius(query, radius), brute;
+        for (size_t i = 0; i < points.size(); ++i)
+            if (points[i].Distance(query) <= radius)
+                brute.push_back(i);
+        std::sort(inRadius.begin(), inRadius.end());
+        Check(inRadius == brute, "PointsInRadius matches brute force");
+    }
+    Check(tree.KNearest({{ 0.5f, 0.5f, 0.5f }}, 0).empty(), "k = 0 finds nothing");
+    Check(tree.KNearest({{ 0.5f, 0.5f, 0.5f }}, 6000).size() == points.size(), "k above the point count finds them all");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+// kNN graph: every row of BuildKnnGraph against brute force, serially and on a thread pool
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+typedef Orthtree<2> qt;
+
+static bool MatchesBruteForce(const qt& tree, const std::vector<qt::VecN>& points, size_t k)
+{
+    const std::vector<size_t> graph = tree.BuildKnnGraph(k);
+    if (graph.size() != points.size() * k)
+        return false;
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        std::vector<float> expected;
+        for (size_t j = 0; j < points.size(); ++j)
+            if (j != i)
+                expected.push_back(points[i].Distance(points[j]));
+        std::sort(expected.begin(), expected.end());
+        for (size_t n = 0; n < k; ++n)
+        {
+            const size_t neighbour = graph[i * k + n];
+            if (n >= expected.size())
+            {
+                if (neighbour != qt::npos)
+                    return false;
+                continue;
+            }
+            if (neighbour == qt::npos || neighbour == i || points[i].Distance(points[neighbour]) != expected[n])
+                return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<qt::VecN> points;
+    for (size_t i = 0; i < 3000; ++i)
+        points.push_back({{ dist(rng) * dist(rng), dist(rng) }});
+    qt tree;
+    tree.Generate({{ 0, 0 }}, {{ 1, 1 }}, 10, points, 6);
+    Check(MatchesBruteForce(tree, points, 1), "1-NN graph");
+    Check(MatchesBruteForce(tree, points, 12), "12-NN graph");
+
+    OrthtreeThreadPool pool(3);
+    tree.SetThreadPool(&pool);
+    Check(MatchesBruteForce(tree, points, 12), "12-NN graph on a thread pool");
+
+    // Fewer points than k pads the rows with npos
+    std::vector<qt::VecN> few(points.begin(), points.begin() + 5);
+    qt small;
+    small.Generate({{ 0, 0 }}, {{ 1, 1 }}, 10, few, 2);
+    Check(MatchesBruteForce(small, few, 8), "rows padded with npos");
+    Check(small.BuildKnnGraph(0).empty(), "k = 0 gives an empty graph");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+// DBSCAN: clusters, border points and noise against a brute-force DBSCAN, serially and on a
+// thread pool, and HDBSCAN core distances against sorted distances
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <random>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+typedef Orthtree<2> qt;
+
+static float DistanceSqr(const qt::VecN& a, const qt::VecN& b)
+{
+    float dSqr = 0.0f;
+    for (size_t d = 0; d < 2; ++d)
+        dSqr += (a[d] - b[d]) * (a[d] - b[d]);
+    return dSqr;
+}
+
+static bool MatchesBruteForce(const std::vector<size_t>& labels, const std::vector<qt::VecN>& points,
+                              float eps, size_t minPoints)
+{
+    const size_t n = points.size();
+    std::vector<std::vector<size_t>> neighbours(n);
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j)
+            if (DistanceSqr(points[i], points[j]) <= eps * eps)
+                neighbours[i].push_back(j);
+    std::vector<bool> core(n);
+    for (size_t i = 0; i < n; ++i)
+        core[i] = neighbours[i].size() >= minPoints;
+
+    // Clusters are the connected components of core points, labelled in any order
+    std::vector<size_t> component(n, qt::npos);
+    size_t numComponents = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!core[i] || component[i] != qt::npos)
+            continue;
+        std::vector<size_t> stack{ i };
+        component[i] = numComponents;
+        while (!stack.empty())
+        {
+            size_t p = stack.back();
+            stack.pop_back();
+            for (size_t q : neighbours[p])
+                if (core[q] && component[q] == qt::npos)
+                {
+                    component[q] = numComponents;
+                    stack.push_back(q);
+                }
+        }
+        ++numComponents;
+    }
+    // Each component has one label of its own
+    std::map<size_t, size_t> labelOf, componentOf;
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!core[i])
+            continue;
+        if (labels[i] == qt::npos || labelOf.emplace(component[i], labels[i]).first->second != labels[i] ||
+            componentOf.emplace(labels[i], component[i]).first->second != component[i])
+            return false;
+    }
+    // Border points take the cluster of one of their core neighbours, the rest are noise
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (core[i])
+            continue;
+        bool nearCore = false, sharesLabel = false;
+        for (size_t q : neighbours[i])
+            if (core[q])
+            {
+                nearCore = true;
+                sharesLabel = sharesLabel || labels[i] == labels[q];
+            }
+        if (nearCore ? !sharesLabel : labels[i] != qt::npos)
+            return false;
+    }
+    return true;
+}
+
+int main()
+{
+    std::mt19937 rng(5);
+    std::normal_distribution<float> spread(0.0f, 0.03f);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<qt::VecN> points;
+    // A few blobs over uniform noise
+    for (size_t blob = 0; blob < 6; ++blob)
+    {
+        const float x = 0.15f + 0.7f * dist(rng), y = 0.15f + 0.7f * dist(rng);
+        for (size_t i = 0; i < 300; ++i)
+            points.push_back({{ std::clamp(x + spread(rng), 0.0f, 0.999f), std::clamp(y + spread(rng), 0.0f, 0.999f) }});
+    }
+    for (size_t i = 0; i < 600; ++i)
+        points.push_back({{ dist(rng), dist(rng) }});
+
+    qt tree;
+    tree.Generate({{ 0, 0 }}, {{ 1, 1 }}, 10, points, 8);
+    Check(MatchesBruteForce(tree.Dbscan(0.02f, 5), points, 0.02f, 5), "DBSCAN eps 0.02");
+    Check(MatchesBruteForce(tree.Dbscan(0.05f, 12), points, 0.05f, 12), "DBSCAN eps 0.05");
+    OrthtreeThreadPool pool(3);
+    tree.SetThreadPool(&pool);
+    Check(MatchesBruteForce(tree.Dbscan(0.02f, 5), points, 0.02f, 5), "DBSCAN on a thread pool");
+
+    const size_t minPoints = 6;
+    const std::vector<float> core = tree.CoreDistances(minPoints);
+    bool coreMatches = core.size() == points.size();
+    for (size_t i = 0; coreMatches && i < points.size(); ++i)
+    {
+        std::vector<float> distances;
+        for (const auto& p : points)
+            distances.push_back(points[i].Distance(p));
+        std::nth_element(distances.begin(), distances.begin() + minPoints - 1, distances.end());
+        coreMatches = std::abs(core[i] - distances[minPoints - 1]) <= 1e-6f;
+    }
+    Check(coreMatches, "core distances");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+// Poisson-disk sampling: no sample lies inside an earlier sample's disc, and the sample is
+// maximal, so every point of the domain lies inside some disc. Both are checked by brute
+// force, with fixed and variable radii, in 2 and 3 dimensions.
+#include <cstdio>
+#include <random>
+#include "Orthtree.h"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+template<size_t N, typename Radius>
+static void CheckSample(float minRadius, float maxRadius, Radius&& radius, size_t numProbes, const char* name)
+{
+    typedef Orthtree<N> ot;
+    typename ot::VecN lower, upper;
+    for (size_t d = 0; d < N; ++d)
+    {
+        lower[d] = 0.0f;
+        upper[d] = 1.0f;
+    }
+    const std::vector<typename ot::VecN> samples = ot::PoissonDiskSample(lower, upper, radius, minRadius, maxRadius, 7);
+
+    bool inside = true, separated = true;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        for (size_t d = 0; d < N; ++d)
+            inside &= samples[i][d] >= 0.0f && samples[i][d] < 1.0f;
+        for (size_t j = 0; j < i; ++j)
+            separated &= samples[i].Distance(samples[j]) >= radius(samples[j]);
+    }
+
+    // Random probes and the corners of a grid must all be covered
+    std::mt19937 rng(8);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    bool maximal = true;
+    for (size_t p = 0; p < numProbes && maximal; ++p)
+    {
+        typename ot::VecN probe;
+        for (size_t d = 0; d < N; ++d)
+            probe[d] = p % 2 ? dist(rng) : static_cast<float>((p / 2) >> (6 * d) & 63) / 64.0f;
+        bool covered = false;
+        for (size_t s = 0; s < samples.size() && !covered; ++s)
+            covered = probe.Distance(samples[s]) < radius(samples[s]);
+        maximal = covered;
+    }
+
+    char what[128];
+    std::snprintf(what, sizeof(what), "%s: samples inside the domain", name);
+    Check(inside, what);
+    std::snprintf(what, sizeof(what), "%s: no sample inside an earlier disc", name);
+    Check(separated, what);
+    std::snprintf(what, sizeof(what), "%s: every probe covered (maximal)", name);
+    Check(maximal, what);
+}
+
+int main()
+{
+    CheckSample<2>(0.02f, 0.02f, [](const Orthtree<2>::VecN&) { return 0.02f; }, 100000, "2D fixed radius");
+    CheckSample<2>(0.01f, 0.05f, [](const Orthtree<2>::VecN& p) { return 0.01f + 0.04f * p[0]; }, 100000,
+                   "2D variable radius");
+    CheckSample<3>(0.08f, 0.08f, [](const Orthtree<3>::VecN&) { return 0.08f; }, 50000, "3D fixed radius");
+
+    std::printf(failures ? "%d check(s) failed\n" : "All checks passed\n", failures);
+    return failures ? 1 : 0;
+}